@@ -0,0 +1,46 @@
+#version 120
+#extension GL_EXT_texture_array : enable
+
+uniform sampler2DArray sampler;
+uniform sampler2D sky_sampler;
+uniform float timer;
+uniform float daylight;
+uniform int ortho;
+
+varying vec2 fragment_uv;
+varying vec2 fragment_tile;
+varying float fragment_ao;
+varying float fragment_light;
+varying float fog_factor;
+varying float fog_height;
+varying float diffuse;
+
+const float pi = 3.14159265;
+
+void main() {
+    // each tile is its own layer, so the quad's uvs repeat it directly
+    // and the mip level follows them without seams
+    vec2 tile = floor(fragment_tile + 0.5);
+    vec4 texel = texture2DArray(sampler,
+        vec3(fragment_uv, tile.y * 16.0 + tile.x));
+    if (texel.a < 0.5) {
+        discard;
+    }
+    vec3 color = texel.rgb;
+    bool cloud = color == vec3(1.0, 1.0, 1.0);
+    if (cloud && bool(ortho)) {
+        discard;
+    }
+    float df = cloud ? 1.0 - diffuse * 0.2 : diffuse;
+    float ao = cloud ? 1.0 - (1.0 - fragment_ao) * 0.2 : fragment_ao;
+    ao = min(1.0, ao + fragment_light);
+    df = min(1.0, df + fragment_light);
+    float value = min(1.0, daylight + fragment_light);
+    vec3 light_color = vec3(value * 0.3 + 0.2);
+    vec3 ambient = vec3(value * 0.3 + 0.2);
+    vec3 light = ambient + light_color * df;
+    color = clamp(color * light * ao, vec3(0.0), vec3(1.0));
+    vec3 sky_color = vec3(texture2D(sky_sampler, vec2(timer, fog_height)));
+    color = mix(color, sky_color, fog_factor);
+    gl_FragColor = vec4(color, 0.2);
+}
@@ -7,6 +7,7 @@ uniform float daylight;
 uniform int ortho;
 
 varying vec2 fragment_uv;
+varying vec2 fragment_tile;
 varying float fragment_ao;
 varying float fragment_light;
 varying float fog_factor;
@@ -14,9 +15,12 @@ varying float fog_height;
 varying float diffuse;
 
 const float pi = 3.14159265;
+const float tile_inset = 1.0 / 128.0;
 
 void main() {
-    vec3 color = vec3(texture2D(sampler, fragment_uv));
+    vec2 tile = floor(fragment_tile + 0.5);
+    vec2 tile_uv = clamp(fract(fragment_uv), tile_inset, 1.0 - tile_inset);
+    vec3 color = vec3(texture2D(sampler, (tile + tile_uv) / 16.0));
     if (color == vec3(1.0, 0.0, 1.0)) {
         discard;
     }
@@ -0,0 +1,56 @@
+#version 120
+
+uniform mat4 matrix;
+uniform vec3 camera;
+uniform vec3 origin;
+uniform float fog_distance;
+uniform int ortho;
+
+// chunk-local corner in blocks and the face index
+attribute vec4 position;
+// tile, ao and light scaled to 0 - 255
+attribute vec4 uv;
+
+varying vec2 fragment_uv;
+varying vec2 fragment_tile;
+varying float fragment_ao;
+varying float fragment_light;
+varying float fog_factor;
+varying float fog_height;
+varying float diffuse;
+
+const float pi = 3.14159265;
+const vec3 light_direction = normalize(vec3(-1.0, 1.0, -1.0));
+const vec3 normals[6] = vec3[6](
+    vec3(-1.0, 0.0, 0.0), vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0),
+    vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, -1.0), vec3(0.0, 0.0, 1.0));
+// world axes that the texture u and v run along, matching make_face
+const vec3 u_axes[6] = vec3[6](
+    vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0), vec3(1.0, 0.0, 0.0),
+    vec3(1.0, 0.0, 0.0), vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0));
+const vec3 v_axes[6] = vec3[6](
+    vec3(0.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, -1.0),
+    vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0));
+
+void main() {
+    int face = int(position.w);
+    vec3 corner = origin + position.xyz;
+    vec4 world = vec4(corner * 2.0 - 1.0, 1.0);
+    gl_Position = matrix * world;
+    fragment_tile = vec2(mod(uv.x, 16.0), floor(uv.x / 16.0));
+    fragment_uv = vec2(dot(corner, u_axes[face]), dot(corner, v_axes[face]));
+    fragment_ao = 0.3 + (1.0 - uv.y / 255.0) * 0.7;
+    fragment_light = uv.z / 255.0 * 0.1;
+    diffuse = max(0.0, dot(normals[face], light_direction));
+    if (bool(ortho)) {
+        fog_factor = 0.0;
+        fog_height = 0.0;
+    }
+    else {
+        float camera_distance = distance(camera, vec3(world));
+        fog_factor = pow(clamp(camera_distance / fog_distance, 0.0, 1.0), 4.0);
+        float dy = world.y - camera.y;
+        float dx = distance(world.xz, camera.xz);
+        fog_height = (atan(dy, dx) + pi / 2) / pi;
+    }
+}
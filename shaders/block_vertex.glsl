@@ -10,6 +10,7 @@ attribute vec3 normal;
 attribute vec4 uv;
 
 varying vec2 fragment_uv;
+varying vec2 fragment_tile;
 varying float fragment_ao;
 varying float fragment_light;
 varying float fog_factor;
@@ -17,11 +18,13 @@ varying float fog_height;
 varying float diffuse;
 
 const float pi = 3.14159265;
+const float tile_stride = 64.0;
 const vec3 light_direction = normalize(vec3(-1.0, 1.0, -1.0));
 
 void main() {
     gl_Position = matrix * position;
-    fragment_uv = uv.xy;
+    fragment_tile = floor(uv.xy / tile_stride);
+    fragment_uv = uv.xy - fragment_tile * tile_stride;
     fragment_ao = 0.3 + (1.0 - uv.z) * 0.7;
     fragment_light = uv.w * 0.1;
     diffuse = max(0.0, dot(normal, light_direction));
@@ -0,0 +1,66 @@
+#version 120
+
+uniform mat4 matrix;
+uniform vec3 camera;
+uniform float fog_distance;
+uniform int ortho;
+
+attribute vec4 position;
+attribute vec3 normal;
+attribute vec4 uv;
+// per instance: world position, then yaw, pitch and the tile set offset
+attribute vec3 instance;
+attribute vec3 orientation;
+
+varying vec2 fragment_uv;
+varying vec2 fragment_tile;
+varying float fragment_ao;
+varying float fragment_light;
+varying float fog_factor;
+varying float fog_height;
+varying float diffuse;
+
+const float pi = 3.14159265;
+const float tile_stride = 64.0;
+const vec3 light_direction = normalize(vec3(-1.0, 1.0, -1.0));
+
+// same layout as mat_rotate
+mat3 rotation(vec3 axis, float angle) {
+    vec3 a = normalize(axis);
+    float s = sin(angle);
+    float c = cos(angle);
+    float m = 1.0 - c;
+    return mat3(
+        m * a.x * a.x + c, m * a.x * a.y - a.z * s, m * a.z * a.x + a.y * s,
+        m * a.x * a.y + a.z * s, m * a.y * a.y + c, m * a.y * a.z - a.x * s,
+        m * a.z * a.x - a.y * s, m * a.y * a.z + a.x * s, m * a.z * a.z + c);
+}
+
+void main() {
+    float rx = orientation.x;
+    float ry = orientation.y;
+    // yaw about y, then pitch about the rotated x axis, as make_player
+    mat3 rotate =
+        rotation(vec3(cos(rx), 0.0, sin(rx)), -ry) *
+        rotation(vec3(0.0, 1.0, 0.0), rx);
+    vec4 world = vec4(rotate * position.xyz + instance, 1.0);
+    gl_Position = matrix * world;
+    vec2 cell = floor(uv.xy / tile_stride);
+    float tile = cell.y * 16.0 + cell.x + orientation.z;
+    fragment_tile = vec2(mod(tile, 16.0), floor(tile / 16.0));
+    fragment_uv = uv.xy - cell * tile_stride;
+    fragment_ao = 0.3 + (1.0 - uv.z) * 0.7;
+    fragment_light = uv.w * 0.1;
+    diffuse = max(0.0, dot(rotate * normal, light_direction));
+    if (bool(ortho)) {
+        fog_factor = 0.0;
+        fog_height = 0.0;
+    }
+    else {
+        float camera_distance = distance(camera, vec3(world));
+        fog_factor = pow(clamp(camera_distance / fog_distance, 0.0, 1.0), 4.0);
+        float dy = world.y - camera.y;
+        float dx = distance(world.xz, camera.xz);
+        fog_height = (atan(dy, dx) + pi / 2) / pi;
+    }
+}
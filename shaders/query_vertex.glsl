@@ -0,0 +1,11 @@
+#version 120
+
+uniform mat4 matrix;
+uniform vec3 origin;
+uniform vec3 size;
+
+attribute vec3 position;
+
+void main() {
+    gl_Position = matrix * vec4(origin + position * size, 1.0);
+}
@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "util.h"
+
+static void slab_insert(ArenaSlab *slab, int index, int offset, int size) {
+    if (slab->free_count == slab->free_capacity) {
+        slab->free_capacity = slab->free_capacity ?
+            slab->free_capacity * 2 : 64;
+        slab->free = (ArenaRange *)realloc(
+            slab->free, sizeof(ArenaRange) * slab->free_capacity);
+    }
+    memmove(slab->free + index + 1, slab->free + index,
+        sizeof(ArenaRange) * (slab->free_count - index));
+    slab->free[index].offset = offset;
+    slab->free[index].size = size;
+    slab->free_count++;
+}
+
+static void slab_remove(ArenaSlab *slab, int index) {
+    memmove(slab->free + index, slab->free + index + 1,
+        sizeof(ArenaRange) * (slab->free_count - index - 1));
+    slab->free_count--;
+}
+
+static void slab_init(ArenaSlab *slab, int size) {
+    memset(slab, 0, sizeof(ArenaSlab));
+    glGenBuffers(1, &slab->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, slab->buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    slab_insert(slab, 0, 0, size);
+}
+
+// First fit within the slab, returns the offset or -1.
+static int slab_alloc(ArenaSlab *slab, int size) {
+    for (int i = 0; i < slab->free_count; i++) {
+        ArenaRange *range = slab->free + i;
+        if (range->size < size) {
+            continue;
+        }
+        int offset = range->offset;
+        range->offset += size;
+        range->size -= size;
+        if (!range->size) {
+            slab_remove(slab, i);
+        }
+        slab->used += size;
+        return offset;
+    }
+    return -1;
+}
+
+// Finds room in any slab but exclude, adding a slab when none has it and
+// grow is set. Returns the slab or -1 when there is no room.
+static int arena_reserve(
+    Arena *arena, int size, int exclude, int grow, int *offset)
+{
+    if (size > arena->slab_size) {
+        return -1;
+    }
+    for (int i = 0; i < arena->slab_count; i++) {
+        if (i == exclude) {
+            continue;
+        }
+        *offset = slab_alloc(arena->slabs + i, size);
+        if (*offset >= 0) {
+            return i;
+        }
+    }
+    if (!grow || arena->slab_count == ARENA_SLABS) {
+        return -1;
+    }
+    int slab = arena->slab_count++;
+    slab_init(arena->slabs + slab, arena->slab_size);
+    *offset = slab_alloc(arena->slabs + slab, size);
+    return slab;
+}
+
+void arena_init(Arena *arena, int slab_size) {
+    memset(arena, 0, sizeof(Arena));
+    arena->slab_size = slab_size;
+}
+
+void arena_free(Arena *arena) {
+    for (int i = 0; i < arena->slab_count; i++) {
+        ArenaSlab *slab = arena->slabs + i;
+        glDeleteBuffers(1, &slab->buffer);
+        free(slab->free);
+    }
+    memset(arena, 0, sizeof(Arena));
+}
+
+// Uploads size bytes of data and returns the slab holding them, with the
+// byte offset in offset, or -1 when the arena is full. Sizes should be
+// whole vertices so every offset stays a multiple of the vertex size.
+int arena_alloc(Arena *arena, int size, const void *data, int *offset) {
+    int slab = arena_reserve(arena, size, -1, 1, offset);
+    if (slab < 0) {
+        return -1;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, arena->slabs[slab].buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, *offset, size, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return slab;
+}
+
+void arena_release(Arena *arena, int slab, int offset, int size) {
+    ArenaSlab *s = arena->slabs + slab;
+    int index = 0;
+    while (index < s->free_count && s->free[index].offset < offset) {
+        index++;
+    }
+    s->used -= size;
+    ArenaRange *prev = index > 0 ? s->free + index - 1 : NULL;
+    ArenaRange *next = index < s->free_count ? s->free + index : NULL;
+    if (prev && prev->offset + prev->size == offset) {
+        prev->size += size;
+        if (next && prev->offset + prev->size == next->offset) {
+            prev->size += next->size;
+            slab_remove(s, index);
+        }
+    }
+    else if (next && offset + size == next->offset) {
+        next->offset = offset;
+        next->size += size;
+    }
+    else {
+        slab_insert(s, index, offset, size);
+    }
+}
+
+// Share of the slab's free space that lies outside its largest hole,
+// 0 when all of it is one range.
+float arena_fragmentation(Arena *arena, int slab) {
+    ArenaSlab *s = arena->slabs + slab;
+    int total = 0;
+    int largest = 0;
+    for (int i = 0; i < s->free_count; i++) {
+        total += s->free[i].size;
+        largest = MAX(largest, s->free[i].size);
+    }
+    return total ? 1 - (float)largest / total : 0;
+}
+
+// Picks the slab wasting the most space in holes, among those whose
+// fragmentation is above threshold. Emptying a slab copies everything
+// still in it, so only slabs that waste at least as much as they hold,
+// and at least an eighth of a slab, are worth it. Returns -1 when none.
+int arena_fragmented_slab(Arena *arena, float threshold) {
+    int result = -1;
+    float worst = arena->slab_size / 8;
+    for (int i = 0; i < arena->slab_count; i++) {
+        int used = arena->slabs[i].used;
+        float fragmentation = arena_fragmentation(arena, i);
+        float waste = fragmentation * (arena->slab_size - used);
+        if (fragmentation <= threshold || waste < used) {
+            continue;
+        }
+        if (waste > worst) {
+            worst = waste;
+            result = i;
+        }
+    }
+    return result;
+}
+
+int arena_can_move(void) {
+    return GLEW_VERSION_3_1 || GLEW_ARB_copy_buffer;
+}
+
+// Copies the range into another existing slab on the GPU and frees it,
+// returning the new slab with its offset in moved_offset, or -1 when
+// there is no room elsewhere.
+int arena_move(Arena *arena, int slab, int offset, int size, int *moved_offset) {
+    int target = arena_reserve(arena, size, slab, 0, moved_offset);
+    if (target < 0) {
+        return -1;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, arena->slabs[slab].buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->slabs[target].buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+        offset, *moved_offset, size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    arena_release(arena, slab, offset, size);
+    arena->moved += size;
+    return target;
+}
+
+void arena_stats(Arena *arena, ArenaStats *stats) {
+    // fragmentation is the free space outside each slab's largest hole,
+    // as a share of all free space
+    memset(stats, 0, sizeof(ArenaStats));
+    stats->slabs = arena->slab_count;
+    stats->capacity = arena->slab_count * arena->slab_size;
+    int available = 0;
+    int scattered = 0;
+    for (int i = 0; i < arena->slab_count; i++) {
+        ArenaSlab *slab = arena->slabs + i;
+        int largest = 0;
+        stats->used += slab->used;
+        stats->holes += slab->free_count;
+        for (int j = 0; j < slab->free_count; j++) {
+            available += slab->free[j].size;
+            largest = MAX(largest, slab->free[j].size);
+        }
+        scattered += arena->slab_size - slab->used - largest;
+        stats->largest = MAX(stats->largest, largest);
+    }
+    stats->fragmentation = available ? (float)scattered / available : 0;
+}
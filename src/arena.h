@@ -0,0 +1,55 @@
+#ifndef _arena_h_
+#define _arena_h_
+
+#include <GL/glew.h>
+
+// most buffers an arena grows to
+#define ARENA_SLABS 8
+
+typedef struct {
+    int offset;
+    int size;
+} ArenaRange;
+
+// One large vertex buffer. Free space is kept as a list of ranges sorted
+// by offset, neighbours merged on release.
+typedef struct {
+    GLuint buffer;
+    int used;
+    ArenaRange *free;
+    int free_count;
+    int free_capacity;
+} ArenaSlab;
+
+// Chunk meshes are sub-allocated from a few large buffers so they can be
+// drawn with the same attribute setup and updated with glBufferSubData
+// instead of creating a buffer object per mesh. Slabs are added as the
+// arena fills up.
+typedef struct {
+    ArenaSlab slabs[ARENA_SLABS];
+    int slab_count;
+    int slab_size;
+    // bytes relocated by arena_move since the arena was created
+    double moved;
+} Arena;
+
+typedef struct {
+    int slabs;
+    int capacity;
+    int used;
+    int holes;
+    int largest;
+    float fragmentation;
+} ArenaStats;
+
+void arena_init(Arena *arena, int slab_size);
+void arena_free(Arena *arena);
+int arena_alloc(Arena *arena, int size, const void *data, int *offset);
+void arena_release(Arena *arena, int slab, int offset, int size);
+float arena_fragmentation(Arena *arena, int slab);
+int arena_fragmented_slab(Arena *arena, float threshold);
+int arena_can_move(void);
+int arena_move(Arena *arena, int slab, int offset, int size, int *moved_offset);
+void arena_stats(Arena *arena, ArenaStats *stats);
+
+#endif
@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chunk.h"
+#include "config.h"
+#include "mesh.h"
+#include "util.h"
+
+#define LOCAL_INDEX(x, y, z) (((y) * CHUNK_SIZE + (z)) * CHUNK_SIZE + (x))
+
+int chunked(int x) {
+    // floor division so that -1 lands in chunk -1, not chunk 0
+    if (x < 0) {
+        return (x + 1) / CHUNK_SIZE - 1;
+    }
+    return x / CHUNK_SIZE;
+}
+
+void block_list_add(BlockList *list, int x, int y, int z, int w) {
+    if (list->size == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        list->data = (Block *)realloc(list->data, sizeof(Block) * capacity);
+        list->capacity = capacity;
+    }
+    Block *block = list->data + list->size++;
+    block->x = x;
+    block->y = y;
+    block->z = z;
+    block->w = w;
+}
+
+void block_list_free(BlockList *list) {
+    free(list->data);
+    list->data = NULL;
+    list->size = 0;
+    list->capacity = 0;
+}
+
+static unsigned int edit_slot(EditMap *edits, int index) {
+    // multiplicative hash; local indices are 15 bits
+    unsigned int slot = ((unsigned int)index * 2654435761u >> 15) & edits->mask;
+    while (edits->data[slot] != EDIT_EMPTY &&
+        (int)(edits->data[slot] >> 8) != index)
+    {
+        slot = (slot + 1) & edits->mask;
+    }
+    return slot;
+}
+
+static void edit_map_alloc(EditMap *edits, unsigned int mask) {
+    edits->size = 0;
+    edits->mask = mask;
+    edits->data = (unsigned int *)malloc(sizeof(unsigned int) * (mask + 1));
+    memset(edits->data, 0xff, sizeof(unsigned int) * (mask + 1));
+}
+
+void edit_map_set(EditMap *edits, int x, int y, int z, int w) {
+    // local coordinates, 0 to CHUNK_SIZE - 1
+    if (!edits->data) {
+        edit_map_alloc(edits, 63);
+    }
+    int index = LOCAL_INDEX(x, y, z);
+    unsigned int slot = edit_slot(edits, index);
+    if (edits->data[slot] == EDIT_EMPTY) {
+        edits->size++;
+    }
+    edits->data[slot] = (unsigned int)index << 8 | w;
+    if (edits->size * 2 > (int)edits->mask) {
+        EditMap grown;
+        edit_map_alloc(&grown, edits->mask << 1 | 1);
+        for (unsigned int i = 0; i <= edits->mask; i++) {
+            unsigned int value = edits->data[i];
+            if (value != EDIT_EMPTY) {
+                grown.data[edit_slot(&grown, value >> 8)] = value;
+                grown.size++;
+            }
+        }
+        free(edits->data);
+        *edits = grown;
+    }
+}
+
+void edit_map_free(EditMap *edits) {
+    free(edits->data);
+    edits->data = NULL;
+    edits->size = 0;
+    edits->mask = 0;
+}
+
+int edit_map_memory(EditMap *edits) {
+    return sizeof(EditMap) +
+        (edits->data ? sizeof(unsigned int) * (edits->mask + 1) : 0);
+}
+
+void chunk_init(Chunk *chunk, int p, int q, int r) {
+    memset(chunk, 0, sizeof(Chunk));
+    chunk->p = p;
+    chunk->q = q;
+    chunk->r = r;
+    chunk->dirty = 1;
+    // starts as all air
+    chunk->palette_size = 1;
+    memset(chunk->heights, -1, sizeof(chunk->heights));
+}
+
+void chunk_free(Chunk *chunk) {
+    free(chunk->indices);
+    chunk->indices = NULL;
+}
+
+static int get_index(unsigned int *indices, int bits, int i) {
+    int bit = i * bits;
+    return (indices[bit >> 5] >> (bit & 31)) & ((1 << bits) - 1);
+}
+
+static void set_index(unsigned int *indices, int bits, int i, int value) {
+    int bit = i * bits;
+    unsigned int mask = ((1u << bits) - 1) << (bit & 31);
+    unsigned int *word = indices + (bit >> 5);
+    *word = (*word & ~mask) | ((unsigned int)value << (bit & 31));
+}
+
+static unsigned int *alloc_indices(int bits) {
+    return (unsigned int *)calloc(CHUNK_VOLUME * bits / 32, sizeof(int));
+}
+
+// Rewrites the indices at a new width, renumbering through map when it
+// is given.
+static void repack(Chunk *chunk, int bits, const unsigned char *map) {
+    unsigned int *indices = bits ? alloc_indices(bits) : NULL;
+    if (bits && chunk->bits) {
+        for (int i = 0; i < CHUNK_VOLUME; i++) {
+            int value = get_index(chunk->indices, chunk->bits, i);
+            set_index(indices, bits, i, map ? map[value] : value);
+        }
+    }
+    free(chunk->indices);
+    chunk->indices = indices;
+    chunk->bits = bits;
+}
+
+static int palette_slot(Chunk *chunk, int w) {
+    int slot = chunk->slots[w];
+    if (slot < chunk->palette_size && chunk->palette[slot] == w) {
+        return slot;
+    }
+    return -1;
+}
+
+int chunk_get_block(Chunk *chunk, int x, int y, int z) {
+    // local coordinates, 0 to CHUNK_SIZE - 1
+    if (!chunk->bits) {
+        return chunk->palette[0];
+    }
+    return chunk->palette[
+        get_index(chunk->indices, chunk->bits, LOCAL_INDEX(x, y, z))];
+}
+
+void chunk_set_block(Chunk *chunk, int x, int y, int z, int w) {
+    int slot = palette_slot(chunk, w);
+    if (slot < 0) {
+        slot = chunk->palette_size++;
+        chunk->palette[slot] = w;
+        chunk->slots[w] = slot;
+        if (chunk->palette_size > 1 << chunk->bits) {
+            repack(chunk, chunk->bits ? chunk->bits * 2 : 1, NULL);
+        }
+    }
+    else if (!chunk->bits) {
+        return;
+    }
+    set_index(chunk->indices, chunk->bits, LOCAL_INDEX(x, y, z), slot);
+    // only removing the top block of a column needs a search, at most
+    // CHUNK_SIZE reads down the same column
+    signed char *height = chunk->heights + z * CHUNK_SIZE + x;
+    if (w && y > *height) {
+        *height = y;
+    }
+    else if (!w && y == *height) {
+        while (*height >= 0 && !chunk_get_block(chunk, x, *height, z)) {
+            (*height)--;
+        }
+    }
+}
+
+void chunk_add_block(Chunk *chunk, int x, int y, int z, int w) {
+    chunk_set_block(chunk,
+        x - chunk->p * CHUNK_SIZE, y - chunk->q * CHUNK_SIZE,
+        z - chunk->r * CHUNK_SIZE, w);
+    chunk->dirty = 1;
+}
+
+void chunk_apply_edits(Chunk *chunk, EditMap *edits) {
+    for (unsigned int i = 0; i <= edits->mask && edits->data; i++) {
+        unsigned int value = edits->data[i];
+        if (value == EDIT_EMPTY) {
+            continue;
+        }
+        int index = value >> 8;
+        chunk_set_block(chunk,
+            index % CHUNK_SIZE, index / (CHUNK_SIZE * CHUNK_SIZE),
+            index / CHUNK_SIZE % CHUNK_SIZE, value & 0xff);
+    }
+    chunk->dirty = 1;
+}
+
+void chunk_compact(Chunk *chunk) {
+    // Ids no longer used are dropped from the palette and the indices
+    // narrowed to fit; a chunk left with a single id loses them entirely.
+    if (!chunk->bits) {
+        return;
+    }
+    int counts[256] = {0};
+    for (int i = 0; i < CHUNK_VOLUME; i++) {
+        counts[get_index(chunk->indices, chunk->bits, i)]++;
+    }
+    unsigned char map[256];
+    int size = 0;
+    for (int i = 0; i < chunk->palette_size; i++) {
+        if (counts[i]) {
+            int w = chunk->palette[i];
+            map[i] = size;
+            chunk->palette[size] = w;
+            chunk->slots[w] = size;
+            size++;
+        }
+    }
+    int changed = size != chunk->palette_size;
+    chunk->palette_size = size;
+    int bits = 0;
+    while (1 << bits < size) {
+        bits = bits ? bits * 2 : 1;
+    }
+    if (bits != chunk->bits || changed) {
+        repack(chunk, bits, map);
+    }
+}
+
+int chunk_block_memory(Chunk *chunk) {
+    // the chunk itself with its palette and heights, plus its indices
+    return sizeof(Chunk) + CHUNK_VOLUME * chunk->bits / 8;
+}
+
+int chunk_memory(Chunk *chunk) {
+    return chunk_block_memory(chunk) + chunk->size;
+}
+
+void chunk_fill_padded(Chunk *neighbours[27], unsigned char *blocks) {
+    // neighbours are indexed (dx + 1) * 9 + (dy + 1) * 3 + (dz + 1),
+    // so the chunk being filled sits at index 13
+    Chunk *chunk = neighbours[13];
+    int ox = chunk->p * CHUNK_SIZE - 1;
+    int oy = chunk->q * CHUNK_SIZE - 1;
+    int oz = chunk->r * CHUNK_SIZE - 1;
+    int size[3] = {PADDED_SIZE, PADDED_HEIGHT, PADDED_SIZE};
+    memset(blocks, 0, PADDED_VOLUME);
+    for (int i = 0; i < 27; i++) {
+        Chunk *other = neighbours[i];
+        if (!other || (!other->bits && !other->palette[0])) {
+            continue;
+        }
+        // the part of the padded array this neighbour covers
+        int base[3] = {
+            other->p * CHUNK_SIZE - ox,
+            other->q * CHUNK_SIZE - oy,
+            other->r * CHUNK_SIZE - oz
+        };
+        int start[3], end[3];
+        for (int j = 0; j < 3; j++) {
+            start[j] = MAX(base[j], 0);
+            end[j] = MIN(base[j] + CHUNK_SIZE, size[j]);
+        }
+        for (int y = start[1]; y < end[1]; y++) {
+            for (int z = start[2]; z < end[2]; z++) {
+                unsigned char *row = blocks + PADDED_INDEX(0, y, z);
+                if (!other->bits) {
+                    memset(row + start[0], other->palette[0],
+                        end[0] - start[0]);
+                    continue;
+                }
+                for (int x = start[0]; x < end[0]; x++) {
+                    row[x] = chunk_get_block(
+                        other, x - base[0], y - base[1], z - base[2]);
+                }
+            }
+        }
+    }
+}
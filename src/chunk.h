@@ -0,0 +1,104 @@
+#ifndef _chunk_h_
+#define _chunk_h_
+
+#include <GL/glew.h>
+#include "mesh.h"
+
+typedef struct {
+    int x;
+    int y;
+    int z;
+    int w;
+} Block;
+
+typedef struct {
+    Block *data;
+    int size;
+    int capacity;
+} BlockList;
+
+#define CHUNK_VOLUME (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
+
+// The edits made to one chunk, at most one per cell: a later write to a
+// cell replaces the earlier one, so replaying them costs one write per
+// edited cell however often each was changed. Open addressing on the
+// local index; each slot is index << 8 | block id, or EDIT_EMPTY.
+#define EDIT_EMPTY 0xffffffffu
+
+typedef struct {
+    int size;
+    unsigned int mask;
+    unsigned int *data;
+} EditMap;
+
+typedef struct {
+    int p;
+    int q;
+    int r;
+
+    // Blocks are stored densely as indices into a palette of the block
+    // ids the chunk uses, packed bits to an index. bits is 1, 2, 4 or 8,
+    // so an index never straddles two words. A chunk of a single id, all
+    // air or all stone, has no indices at all and bits 0.
+    unsigned char palette[256];
+    // palette slot of each id, valid when palette[slots[w]] == w
+    unsigned char slots[256];
+    int palette_size;
+    int bits;
+    unsigned int *indices;
+    // local y of the highest solid block in each column, z * CHUNK_SIZE
+    // + x, or -1 when the column is empty
+    signed char heights[CHUNK_SIZE * CHUNK_SIZE];
+
+    int dirty;
+    // id of the mesh job in flight, 0 when none
+    int pending;
+    int faces;
+    int skipped;
+    int min[3];
+    int max[3];
+    // mesh flags the buffer was built with and its size in bytes
+    int flags;
+    int size;
+    GLuint buffer;
+    // set when the vertices live in an arena slab at offset instead
+    int batched;
+    int slab;
+    int offset;
+    // attribute setup for buffer, made on its first draw
+    GLuint vao;
+    // solid boxes that hide chunks behind this one
+    int occluder_count;
+    Occluder occluders[MESH_MAX_OCCLUDERS];
+    // passed culling in the current frame
+    int visible;
+    // occlusion query of the bounding box, issued in an earlier frame
+    // and read once its result is available
+    GLuint query;
+    int query_pending;
+    // the last query saw no samples
+    int hidden;
+    // the frame the chunk last reached the query test, and whether the
+    // query in flight predates a frame it missed
+    int query_frame;
+    int query_stale;
+} Chunk;
+
+int chunked(int x);
+void block_list_add(BlockList *list, int x, int y, int z, int w);
+void block_list_free(BlockList *list);
+void edit_map_set(EditMap *edits, int x, int y, int z, int w);
+void edit_map_free(EditMap *edits);
+int edit_map_memory(EditMap *edits);
+void chunk_init(Chunk *chunk, int p, int q, int r);
+void chunk_free(Chunk *chunk);
+int chunk_get_block(Chunk *chunk, int x, int y, int z);
+void chunk_set_block(Chunk *chunk, int x, int y, int z, int w);
+void chunk_add_block(Chunk *chunk, int x, int y, int z, int w);
+void chunk_apply_edits(Chunk *chunk, EditMap *edits);
+void chunk_compact(Chunk *chunk);
+int chunk_block_memory(Chunk *chunk);
+int chunk_memory(Chunk *chunk);
+void chunk_fill_padded(Chunk *neighbours[27], unsigned char *blocks);
+
+#endif
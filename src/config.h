@@ -7,14 +7,47 @@
 
 #define SHOW_INFO_TEXT 1
 #define INVERT_MOUSE 0
+#define USE_TEXTURE_ARRAY 1
 
 #define CUBE_KEY_FORWARD 'W'
 #define CUBE_KEY_BACKWARD 'S'
 #define CUBE_KEY_LEFT 'A'
 #define CUBE_KEY_RIGHT 'D'
 #define CUBE_KEY_JUMP GLFW_KEY_SPACE
+#define CUBE_KEY_GREEDY 'G'
+#define CUBE_KEY_WORKERS 'T'
+#define CUBE_KEY_PACKED 'P'
+#define CUBE_KEY_INDEXED 'I'
+#define CUBE_KEY_VERTEX_ARRAYS 'V'
+#define CUBE_KEY_BATCHED 'B'
+#define CUBE_KEY_TEXT_CACHE 'C'
+#define CUBE_KEY_INSTANCED 'N'
+#define CUBE_KEY_SPAWN 'E'
+#define CUBE_KEY_OCCLUSION 'O'
+#define CUBE_KEY_RAYCAST 'R'
+#define CUBE_KEY_QUERIES 'Q'
+#define CUBE_KEY_HEIGHTS 'H'
+
+#define HIT_DISTANCE 8
+#define BUILD_BLOCK 3
+#define RAYCAST_BENCHMARK_RAYS 1000000
+#define HEIGHT_BENCHMARK_QUERIES 1000000
+#define HEIGHT_BENCHMARK_SCAN_RATIO 100
+// world y below which the player is put back on top of the terrain
+#define FALL_LIMIT -512
 
 #define RENDER_CHUNK_RADIUS 10
 #define CHUNK_SIZE 32
+#define CHUNK_MEMORY_BUDGET (256 * 1024 * 1024)
+#define UPLOAD_BUDGET_BYTES (2 * 1024 * 1024)
+#define UPLOAD_BUDGET_MS 2
+#define ARENA_SLAB_SIZE (32 * 1024 * 1024)
+#define ARENA_DEFRAG_THRESHOLD 0.5
+#define ARENA_DEFRAG_BYTES (4 * 1024 * 1024)
+#define ENTITY_SPAWN_COUNT 1000
+#define ENTITY_RANGE 32
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_CHUNKS 32
 
 #endif
@@ -4,20 +4,74 @@
 #include "item.h"
 #include "util.h"
 
-void make_cube_faces(
-    float *data, float ao[6][4], float light[6][4],
-    int left, int right, int top, int bottom, int front, int back,
-    int wleft, int wright, int wtop, int wbottom, int wfront, int wback,
-    float x, float y, float z, float n)
+static const float positions[6][4][3] = {
+    {{-1, -1, -1}, {-1, -1, +1}, {-1, +1, -1}, {-1, +1, +1}},
+    {{+1, -1, -1}, {+1, -1, +1}, {+1, +1, -1}, {+1, +1, +1}},
+    {{-1, +1, -1}, {-1, +1, +1}, {+1, +1, -1}, {+1, +1, +1}},
+    {{-1, -1, -1}, {-1, -1, +1}, {+1, -1, -1}, {+1, -1, +1}},
+    {{-1, -1, -1}, {-1, +1, -1}, {+1, -1, -1}, {+1, +1, -1}},
+    {{-1, -1, +1}, {-1, +1, +1}, {+1, -1, +1}, {+1, +1, +1}}
+};
+
+static const float indices[6][6] = {
+    {0, 3, 2, 0, 1, 3},
+    {0, 3, 1, 0, 2, 3},
+    {0, 3, 2, 0, 1, 3},
+    {0, 3, 1, 0, 2, 3},
+    {0, 3, 2, 0, 1, 3},
+    {0, 3, 1, 0, 2, 3}
+};
+
+static const float flipped[6][6] = {
+    {0, 1, 2, 1, 3, 2},
+    {0, 2, 1, 2, 3, 1},
+    {0, 1, 2, 1, 3, 2},
+    {0, 2, 1, 2, 3, 1},
+    {0, 1, 2, 1, 3, 2},
+    {0, 2, 1, 2, 3, 1}
+};
+
+// corners in the order gen_quad_buffer's {0, 1, 2, 0, 2, 3} pattern turns
+// into the same two triangles as indices and flipped
+static const int quad_indices[6][4] = {
+    {0, 1, 3, 2},
+    {0, 2, 3, 1},
+    {0, 1, 3, 2},
+    {0, 2, 3, 1},
+    {0, 1, 3, 2},
+    {0, 2, 3, 1}
+};
+
+static const int quad_flipped[6][4] = {
+    {1, 3, 2, 0},
+    {2, 3, 1, 0},
+    {1, 3, 2, 0},
+    {2, 3, 1, 0},
+    {1, 3, 2, 0},
+    {2, 3, 1, 0}
+};
+
+// Fills order with the corners to emit for the face, splitting the quad
+// along the diagonal that keeps the ao interpolation symmetric, and
+// returns how many there are.
+static int face_order(int face, float ao[4], int indexed, int order[6]) {
+    int flip = ao[0] + ao[3] > ao[1] + ao[2];
+    if (indexed) {
+        for (int v = 0; v < 4; v++) {
+            order[v] = flip ? quad_flipped[face][v] : quad_indices[face][v];
+        }
+        return 4;
+    }
+    for (int v = 0; v < 6; v++) {
+        order[v] = flip ? flipped[face][v] : indices[face][v];
+    }
+    return 6;
+}
+
+void make_face(
+    float *data, float ao[4], float light[4], int face, int tile,
+    float x, float y, float z, float n, int sx, int sy, int sz, int indexed)
 {
-    static const float positions[6][4][3] = {
-        {{-1, -1, -1}, {-1, -1, +1}, {-1, +1, -1}, {-1, +1, +1}},
-        {{+1, -1, -1}, {+1, -1, +1}, {+1, +1, -1}, {+1, +1, +1}},
-        {{-1, +1, -1}, {-1, +1, +1}, {+1, +1, -1}, {+1, +1, +1}},
-        {{-1, -1, -1}, {-1, -1, +1}, {+1, -1, -1}, {+1, -1, +1}},
-        {{-1, -1, -1}, {-1, +1, -1}, {+1, -1, -1}, {+1, +1, -1}},
-        {{-1, -1, +1}, {-1, +1, +1}, {+1, -1, +1}, {+1, +1, +1}}
-    };
     static const float normals[6][3] = {
         {-1, 0, 0},
         {+1, 0, 0},
@@ -34,48 +88,77 @@ void make_cube_faces(
         {{0, 0}, {0, 1}, {1, 0}, {1, 1}},
         {{1, 0}, {1, 1}, {0, 0}, {0, 1}}
     };
-    static const float indices[6][6] = {
-        {0, 3, 2, 0, 1, 3},
-        {0, 3, 1, 0, 2, 3},
-        {0, 3, 2, 0, 1, 3},
-        {0, 3, 1, 0, 2, 3},
-        {0, 3, 2, 0, 1, 3},
-        {0, 3, 1, 0, 2, 3}
-    };
-    static const float flipped[6][6] = {
-        {0, 1, 2, 1, 3, 2},
-        {0, 2, 1, 2, 3, 1},
-        {0, 1, 2, 1, 3, 2},
-        {0, 2, 1, 2, 3, 1},
-        {0, 1, 2, 1, 3, 2},
-        {0, 2, 1, 2, 3, 1}
+    // axis that u and v run along for each face, used to repeat the tile
+    // across faces that span more than one block
+    static const int uv_axes[6][2] = {
+        {2, 1}, {2, 1}, {0, 2}, {0, 2}, {0, 1}, {0, 1}
     };
     float *d = data;
-    float s = 0.0625;
-    float a = 0 + 1 / 2048.0;
-    float b = s - 1 / 2048.0;
+    int i = face;
+    int size[3] = {sx, sy, sz};
+    float center[3] = {x, y, z};
+    // uv holds the tile's atlas cell times TILE_STRIDE plus the block-space
+    // coordinate within the face; the fragment shader wraps the latter
+    float du = (tile % 16) * TILE_STRIDE;
+    float dv = (tile / 16) * TILE_STRIDE;
+    float su = size[uv_axes[i][0]];
+    float sv = size[uv_axes[i][1]];
+    int order[6];
+    int count = face_order(i, ao, indexed, order);
+    for (int v = 0; v < count; v++) {
+        int j = order[v];
+        for (int k = 0; k < 3; k++) {
+            float offset = positions[i][j][k] < 0 ? -1 : size[k] * 2 - 1;
+            *(d++) = center[k] + n * offset;
+        }
+        *(d++) = normals[i][0];
+        *(d++) = normals[i][1];
+        *(d++) = normals[i][2];
+        *(d++) = du + uvs[i][j][0] * su;
+        *(d++) = dv + uvs[i][j][1] * sv;
+        *(d++) = ao[j];
+        *(d++) = light[j];
+    }
+}
+
+void make_face_packed(
+    unsigned char *data, float ao[4], float light[4], int face, int tile,
+    int x, int y, int z, int sx, int sy, int sz, int indexed)
+{
+    unsigned char *d = data;
+    int i = face;
+    int origin[3] = {x, y, z};
+    int size[3] = {sx, sy, sz};
+    int order[6];
+    int count = face_order(i, ao, indexed, order);
+    for (int v = 0; v < count; v++) {
+        int j = order[v];
+        for (int k = 0; k < 3; k++) {
+            *(d++) = origin[k] + (positions[i][j][k] < 0 ? 0 : size[k]);
+        }
+        *(d++) = face;
+        *(d++) = tile;
+        *(d++) = roundf(ao[j] * 255);
+        *(d++) = roundf(light[j] * 255);
+        *(d++) = 0;
+    }
+}
+
+void make_cube_faces(
+    float *data, float ao[6][4], float light[6][4],
+    int left, int right, int top, int bottom, int front, int back,
+    int wleft, int wright, int wtop, int wbottom, int wfront, int wback,
+    float x, float y, float z, float n)
+{
+    float *d = data;
     int faces[6] = {left, right, top, bottom, front, back};
     int tiles[6] = {wleft, wright, wtop, wbottom, wfront, wback};
     for (int i = 0; i < 6; i++) {
         if (faces[i] == 0) {
             continue;
         }
-        float du = (tiles[i] % 16) * s;
-        float dv = (tiles[i] / 16) * s;
-        int flip = ao[i][0] + ao[i][3] > ao[i][1] + ao[i][2];
-        for (int v = 0; v < 6; v++) {
-            int j = flip ? flipped[i][v] : indices[i][v];
-            *(d++) = x + n * positions[i][j][0];
-            *(d++) = y + n * positions[i][j][1];
-            *(d++) = z + n * positions[i][j][2];
-            *(d++) = normals[i][0];
-            *(d++) = normals[i][1];
-            *(d++) = normals[i][2];
-            *(d++) = du + (uvs[i][j][0] ? b : a);
-            *(d++) = dv + (uvs[i][j][1] ? b : a);
-            *(d++) = ao[i][j];
-            *(d++) = light[i][j];
-        }
+        make_face(d, ao[i], light[i], i, tiles[i], x, y, z, n, 1, 1, 1, 0);
+        d += 60;
     }
 }
 
@@ -97,10 +180,7 @@ void make_cube(
         x, y, z, n);
 }
 
-void make_player(
-    float *data,
-    float x, float y, float z, float rx, float ry)
-{
+void make_player_cube(float *data) {
     float ao[6][4] = {0};
     float light[6][4] = {
         {0.8, 0.8, 0.8, 0.8},
@@ -115,6 +195,13 @@ void make_player(
         1, 1, 1, 1, 1, 1,
         226, 224, 241, 209, 225, 227,
         0, 0, 0, 0.4);
+}
+
+void make_player(
+    float *data,
+    float x, float y, float z, float rx, float ry)
+{
+    make_player_cube(data);
     float ma[16];
     float mb[16];
     mat_identity(ma);
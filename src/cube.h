@@ -1,6 +1,22 @@
 #ifndef _cube_h_
 #define _cube_h_
 
+// spacing between atlas cells in the uv attribute, must stay above the
+// largest face size in blocks and match block_vertex.glsl
+#define TILE_STRIDE 64
+
+// indexed faces write 4 vertices meant for gen_quad_buffer's elements,
+// otherwise 6 vertices of two triangles
+void make_face(
+    float *data, float ao[4], float light[4], int face, int tile,
+    float x, float y, float z, float n, int sx, int sy, int sz, int indexed);
+
+// 8 byte vertices: chunk-local corner in blocks and the face index,
+// then tile, ao and light scaled to 0 - 255 and a padding byte
+void make_face_packed(
+    unsigned char *data, float ao[4], float light[4], int face, int tile,
+    int x, int y, int z, int sx, int sy, int sz, int indexed);
+
 void make_cube_faces(
     float *data, float ao[6][4], float light[6][4],
     int left, int right, int top, int bottom, int front, int back,
@@ -12,6 +28,10 @@ void make_cube(
     int left, int right, int top, int bottom, int front, int back,
     float x, float y, float z, float n, int w);
 
+// the player's cube at the origin, for drawing with per-instance
+// position and rotation
+void make_player_cube(float *data);
+
 void make_player(
     float *data,
     float x, float y, float z, float rx, float ry);
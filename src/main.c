@@ -1,30 +1,36 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include "arena.h"
+#include "chunk.h"
 #include "config.h"
 #include "cube.h"
+#include "map.h"
 #include "matrix.h"
+#include "mesh.h"
+#include "occlusion.h"
 #include "util.h"
+#include "worker.h"
+#include "world.h"
 
-#define MAX_BLOCKS 65536
 #define MAX_PLAYERS 8
+// the player's box around the camera, in world units
+#define PLAYER_HALF_WIDTH 0.6
+#define PLAYER_BELOW_EYE 3.2
+#define PLAYER_ABOVE_EYE 0.4
+#define MAX_CHUNK_LOADS 8
+// highest_block() of a column with no solid block loaded
+#define NO_HEIGHT INT_MIN
 
 #define ALIGN_LEFT 0
 #define ALIGN_CENTER 1
 #define ALIGN_RIGHT 2
 
-typedef struct {
-  int x;
-  int y;
-  int z;
-  int w;
-
-  GLuint buffer;
-} Block;
-
 typedef struct {
   float x;
   float y;
@@ -40,9 +46,61 @@ typedef struct {
 
 typedef struct {
   State state;
-  GLuint buffer;
 } Player;
 
+// A free-moving cube that drifts and tumbles around where it was spawned.
+typedef struct {
+  State state;
+  float home[3];
+  float velocity[3];
+  float spin;
+  float tiles;
+} Entity;
+
+typedef struct {
+  Chunk *chunk;
+  int distance;
+} OccluderChunk;
+
+// The highest loaded solid block of every x, z in a column of chunks,
+// kept up to date as chunks load, unload and change.
+typedef struct {
+  int heights[CHUNK_SIZE * CHUNK_SIZE];
+  int q_min;
+  int q_max;
+  int chunks;
+} Column;
+
+// per instance: x, y, z, rx, ry and the tile set offset
+#define INSTANCE_COMPONENTS 6
+
+#define TEXT_CACHE_SIZE 32
+#define MAX_TEXT_LENGTH 256
+
+// A string drawn at the same place on consecutive frames keeps its
+// glyph vertices; only the glyphs that changed are rebuilt.
+typedef struct {
+  float x;
+  float y;
+  float n;
+  int justify;
+  unsigned int hash;
+  char text[MAX_TEXT_LENGTH];
+  int length;
+  int frame;
+  GLfloat data[MAX_TEXT_LENGTH * 24];
+} TextLine;
+
+// visible arena chunks of one vertex format, laid out for glMultiDraw*
+typedef struct {
+  int size;
+  int capacity;
+  GLint *first;
+  GLsizei *count;
+  GLvoid **indices;
+  Chunk **chunks;
+} DrawList;
+
 typedef struct {
   GLFWwindow *window;
   int width;
@@ -53,8 +111,99 @@ typedef struct {
   int render_radius;
   Camera camera;
 
-  Block blocks[MAX_BLOCKS];
-  int block_count;
+  Map chunks;
+  int chunk_count;
+  int chunk_memory;
+  // bytes held by g->edits, counted in chunk_memory
+  int edit_memory;
+  // chunks of a single block id, and bytes of block storage in all
+  // chunks, meshes excluded
+  int uniform_count;
+  int block_bytes;
+  Map edits;
+  // Column per p, r, keyed (p, 0, r)
+  Map columns;
+  int face_count;
+  int skipped_count;
+  int tested_count;
+  int culled_count;
+  int drawn_count;
+  int greedy;
+  int packed;
+  int indexed;
+  GLuint quad_buffer;
+  int vertex_arrays;
+  GLuint text_vao;
+  int batched;
+  int base_vertex;
+  Arena arenas[2];
+  DrawList batches[4][ARENA_SLABS];
+  int draw_calls;
+  int text_cache;
+  int text_frame;
+  int text_width;
+  int text_height;
+  int text_glyphs;
+  TextLine text_lines[TEXT_CACHE_SIZE];
+  // the frame's strings, drawn together by flush_text
+  GLfloat *text_data;
+  int text_count;
+  int text_capacity;
+  int text_strings;
+  GLuint text_buffer;
+  int text_buffer_size;
+  FrameHistogram text_times;
+  FrameHistogram draw_times;
+  int raycast_benchmark;
+  double ray_rate;
+  int ray_hits;
+  int height_benchmark;
+  double height_rate;
+  double scan_rate;
+  int occlusion;
+  OcclusionBuffer occlusion_buffer;
+  // chunks drawn into occlusion_buffer, nearest first
+  OccluderChunk *occluders;
+  int occluder_count;
+  int occluder_capacity;
+  int occluded_count;
+  FrameHistogram occlusion_times;
+  int queries;
+  // chunks whose bounding boxes are queried after this frame's draws
+  Chunk **query_chunks;
+  int query_count;
+  int query_capacity;
+  GLuint query_buffer;
+  int query_hidden_count;
+  int conditional_count;
+  // counts render_blocks calls, for Chunk.query_frame
+  int query_frame;
+  Entity *entities;
+  int entity_count;
+  int entity_capacity;
+  int instanced;
+  GLuint entity_buffer;
+  GLfloat *instance_data;
+  int instance_capacity;
+  GLuint instance_buffer;
+  int instance_buffer_size;
+  int entity_draws;
+  FrameHistogram entity_times;
+  int vertex_count;
+  int vertex_bytes;
+  double upload_total_bytes;
+  double upload_total_time;
+
+  WorkerPool workers;
+  int threaded;
+  int job_count;
+  int jobs_in_flight;
+  MeshJob **ready;
+  int ready_count;
+  int ready_capacity;
+  int upload_count;
+  int upload_bytes;
+  FrameHistogram frames;
 
   int flying;
   bool game_running;
@@ -79,183 +228,1850 @@ typedef struct {
     GLuint extra2;
     GLuint extra3;
     GLuint extra4;
+    GLuint extra5;
+    GLuint instance;
+    GLuint orientation;
 } Attrib;
 
-void on_key_press(GLFWwindow *window, int key, int scancode, int action, int mods) {
-  if (key == GLFW_KEY_ESCAPE) {
-    printf("ESC PRESSED...\n");
-    g->game_running = false;
+void dirty_all_chunks() {
+  MAP_FOR_EACH(&g->chunks, entry) {
+    Chunk *chunk = (Chunk *)entry->value;
+    chunk->dirty = 1;
+  } END_MAP_FOR_EACH;
+}
+
+void change_vertex_format() {
+  // upload totals restart so each format is measured on its own
+  g->upload_total_bytes = 0;
+  g->upload_total_time = 0;
+  dirty_all_chunks();
+}
+
+float random_range(float low, float high) {
+  return low + (high - low) * rand() / RAND_MAX;
+}
+
+void spawn_entities(int count) {
+  if (g->entity_count + count > g->entity_capacity) {
+    g->entity_capacity = MAX(g->entity_capacity * 2, g->entity_count + count);
+    g->entities = realloc(g->entities, sizeof(Entity) * g->entity_capacity);
+  }
+  State *s = &g->camera.state;
+  for (int i = 0; i < count; i++) {
+    Entity *entity = g->entities + g->entity_count++;
+    entity->home[0] = s->x + random_range(-ENTITY_RANGE, ENTITY_RANGE);
+    entity->home[1] = s->y + random_range(-ENTITY_RANGE, ENTITY_RANGE) / 2;
+    entity->home[2] = s->z + random_range(-ENTITY_RANGE, ENTITY_RANGE);
+    entity->state.x = entity->home[0];
+    entity->state.y = entity->home[1];
+    entity->state.z = entity->home[2];
+    entity->state.rx = random_range(0, 2 * PI);
+    entity->state.ry = random_range(-PI / 4, PI / 4);
+    for (int j = 0; j < 3; j++) {
+      entity->velocity[j] = random_range(-4, 4);
+    }
+    entity->spin = random_range(-2, 2);
+    // shift the player's tiles down whole rows of the atlas
+    entity->tiles = -16 * (rand() % 4);
+  }
+}
+
+void on_key_press(GLFWwindow *window, int key, int scancode, int action, int mods) {
+  if (key == GLFW_KEY_ESCAPE) {
+    printf("ESC PRESSED...\n");
+    g->game_running = false;
+  }
+  if (action != GLFW_PRESS) {
+    return;
+  }
+  if (key == CUBE_KEY_GREEDY) {
+    g->greedy = !g->greedy;
+    dirty_all_chunks();
+  }
+  if (key == CUBE_KEY_PACKED) {
+    g->packed = !g->packed;
+    change_vertex_format();
+  }
+  if (key == CUBE_KEY_INDEXED) {
+    g->indexed = !g->indexed;
+    change_vertex_format();
+  }
+  if (key == CUBE_KEY_VERTEX_ARRAYS && has_vertex_arrays()) {
+    g->vertex_arrays = !g->vertex_arrays;
+    frame_histogram_reset(&g->draw_times);
+  }
+  if (key == CUBE_KEY_BATCHED) {
+    g->batched = !g->batched;
+    change_vertex_format();
+  }
+  if (key == CUBE_KEY_TEXT_CACHE) {
+    g->text_cache = !g->text_cache;
+    frame_histogram_reset(&g->text_times);
+  }
+  if (key == CUBE_KEY_RAYCAST) {
+    g->raycast_benchmark = 1;
+  }
+  if (key == CUBE_KEY_HEIGHTS) {
+    g->height_benchmark = 1;
+  }
+  if (key == CUBE_KEY_OCCLUSION) {
+    g->occlusion = !g->occlusion;
+    frame_histogram_reset(&g->occlusion_times);
+  }
+  if (key == CUBE_KEY_QUERIES && has_occlusion_queries()) {
+    g->queries = !g->queries;
+    MAP_FOR_EACH(&g->chunks, entry) {
+      Chunk *chunk = (Chunk *)entry->value;
+      chunk->hidden = 0;
+    } END_MAP_FOR_EACH;
+  }
+  if (key == CUBE_KEY_INSTANCED && has_instancing()) {
+    g->instanced = !g->instanced;
+    frame_histogram_reset(&g->entity_times);
+  }
+  if (key == CUBE_KEY_SPAWN) {
+    spawn_entities(ENTITY_SPAWN_COUNT);
+  }
+  if (key == CUBE_KEY_WORKERS) {
+    g->threaded = !g->threaded;
+    frame_histogram_reset(&g->frames);
+  }
+}
+
+int get_scale_factor() {
+  int window_width, window_height;
+  int buffer_width, buffer_height;
+  glfwGetWindowSize(g->window, &window_width, &window_height);
+  glfwGetFramebufferSize(g->window, &buffer_width, &buffer_height);
+  int result = buffer_width / window_width;
+  result = MAX(1, result);
+  result = MIN(2, result);
+  return result;
+}
+
+void draw_triangles_2d(Attrib *attrib, GLuint buffer, int count) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glEnableVertexAttribArray(attrib->position);
+  glEnableVertexAttribArray(attrib->uv);
+  glVertexAttribPointer(attrib->position, 2, GL_FLOAT, GL_FALSE,
+      sizeof(GLfloat) * 4, 0);
+  glVertexAttribPointer(attrib->uv, 2, GL_FLOAT, GL_FALSE,
+      sizeof(GLfloat) * 4, (GLvoid *)(sizeof(GLfloat) * 2));
+  glDrawArrays(GL_TRIANGLES, 0, count);
+  glDisableVertexAttribArray(attrib->position);
+  glDisableVertexAttribArray(attrib->uv);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void draw_triangles_3d_ao(Attrib *attrib, GLuint buffer, int count) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glEnableVertexAttribArray(attrib->position);
+  glEnableVertexAttribArray(attrib->normal);
+  glEnableVertexAttribArray(attrib->uv);
+  glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
+      sizeof(GLfloat) * 10, 0);
+  glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
+      sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
+  glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
+      sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
+  glDrawArrays(GL_TRIANGLES, 0, count);
+  glDisableVertexAttribArray(attrib->position);
+  glDisableVertexAttribArray(attrib->normal);
+  glDisableVertexAttribArray(attrib->uv);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void enable_chunk_attribs(Attrib *attrib, GLuint buffer, int flags) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glEnableVertexAttribArray(attrib->position);
+  glEnableVertexAttribArray(attrib->uv);
+  if (flags & MESH_PACKED) {
+    glVertexAttribPointer(attrib->position, 4, GL_UNSIGNED_BYTE, GL_FALSE,
+        PACKED_VERTEX_SIZE, 0);
+    glVertexAttribPointer(attrib->uv, 4, GL_UNSIGNED_BYTE, GL_FALSE,
+        PACKED_VERTEX_SIZE, (GLvoid *)4);
+  }
+  else {
+    glEnableVertexAttribArray(attrib->normal);
+    glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
+        sizeof(GLfloat) * 10, 0);
+    glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
+        sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
+    glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
+        sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
+  }
+  if (flags & MESH_INDEXED) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->quad_buffer);
+  }
+}
+
+void disable_chunk_attribs(Attrib *attrib, int flags) {
+  glDisableVertexAttribArray(attrib->position);
+  if (!(flags & MESH_PACKED)) {
+    glDisableVertexAttribArray(attrib->normal);
+  }
+  glDisableVertexAttribArray(attrib->uv);
+  if (flags & MESH_INDEXED) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void draw_chunk(Attrib *attrib, Chunk *chunk) {
+  // With vertex arrays the attribute setup is recorded once per buffer
+  // and each later draw is a bind and a draw. The caller unbinds the last
+  // array after its loop.
+  if (g->vertex_arrays) {
+    if (!chunk->vao) {
+      chunk->vao = gen_vertex_array();
+      bind_vertex_array(chunk->vao);
+      enable_chunk_attribs(attrib, chunk->buffer, chunk->flags);
+    }
+    else {
+      bind_vertex_array(chunk->vao);
+    }
+  }
+  else {
+    enable_chunk_attribs(attrib, chunk->buffer, chunk->flags);
+  }
+  if (chunk->flags & MESH_INDEXED) {
+    glDrawElements(GL_TRIANGLES, chunk->faces * 6, GL_UNSIGNED_INT, 0);
+  }
+  else {
+    glDrawArrays(GL_TRIANGLES, 0, chunk->faces * 6);
+  }
+  if (!g->vertex_arrays) {
+    disable_chunk_attribs(attrib, chunk->flags);
+  }
+  g->draw_calls++;
+}
+
+int batch_index(int flags) {
+  return (flags & MESH_PACKED ? 2 : 0) + (flags & MESH_INDEXED ? 1 : 0);
+}
+
+void batch_add(Chunk *chunk) {
+  DrawList *list = g->batches[batch_index(chunk->flags)] + chunk->slab;
+  if (list->size == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 256;
+    list->first = realloc(list->first, sizeof(GLint) * list->capacity);
+    list->count = realloc(list->count, sizeof(GLsizei) * list->capacity);
+    list->indices = realloc(list->indices, sizeof(GLvoid *) * list->capacity);
+    list->chunks = realloc(list->chunks, sizeof(Chunk *) * list->capacity);
+  }
+  // indexed draws read the shared quad elements from the start, offset
+  // by first as their base vertex
+  list->first[list->size] = chunk->offset / mesh_vertex_size(chunk->flags);
+  list->count[list->size] = chunk->faces * 6;
+  list->indices[list->size] = 0;
+  list->chunks[list->size] = chunk;
+  list->size++;
+}
+
+void flush_batch(Attrib *attrib, int index) {
+  // Float vertices hold world positions, so the visible chunks of each
+  // arena slab go out in one multi-draw. Packed ones still need their
+  // chunk origin uniform between draws, but share the attribute setup.
+  int flags = (index & 2 ? MESH_PACKED : 0) | (index & 1 ? MESH_INDEXED : 0);
+  Arena *arena = g->arenas + (flags & MESH_PACKED ? 1 : 0);
+  for (int slab = 0; slab < arena->slab_count; slab++) {
+    DrawList *list = g->batches[index] + slab;
+    if (!list->size) {
+      continue;
+    }
+    if (g->vertex_arrays) {
+      bind_vertex_array(0);
+    }
+    enable_chunk_attribs(attrib, arena->slabs[slab].buffer, flags);
+    if (!(flags & MESH_PACKED)) {
+      if (flags & MESH_INDEXED) {
+        glMultiDrawElementsBaseVertex(
+          GL_TRIANGLES, list->count, GL_UNSIGNED_INT,
+          (const GLvoid *const *)list->indices, list->size, list->first);
+      }
+      else {
+        glMultiDrawArrays(GL_TRIANGLES, list->first, list->count, list->size);
+      }
+      g->draw_calls++;
+    }
+    else {
+      for (int i = 0; i < list->size; i++) {
+        Chunk *chunk = list->chunks[i];
+        glUniform3f(attrib->extra5,
+          chunk->p * CHUNK_SIZE, chunk->q * CHUNK_SIZE, chunk->r * CHUNK_SIZE);
+        if (flags & MESH_INDEXED) {
+          glDrawElementsBaseVertex(
+            GL_TRIANGLES, list->count[i], GL_UNSIGNED_INT, 0, list->first[i]);
+        }
+        else {
+          glDrawArrays(GL_TRIANGLES, list->first[i], list->count[i]);
+        }
+        g->draw_calls++;
+      }
+    }
+    disable_chunk_attribs(attrib, flags);
+    list->size = 0;
+  }
+}
+
+Chunk *find_chunk(int p, int q, int r) {
+  return (Chunk *)map_get(&g->chunks, p, q, r);
+}
+
+int block_position(float x) {
+  // blocks are two world units wide and centered on even coordinates
+  return roundf(x / 2);
+}
+
+int chunk_distance(int p, int q, int r, int cp, int cq, int cr) {
+  int dp = p - cp;
+  int dq = q - cq;
+  int dr = r - cr;
+  return dp * dp + dq * dq + dr * dr;
+}
+
+int chunk_in_radius(int p, int q, int r) {
+  State *s = &g->camera.state;
+  int cp = chunked(block_position(s->x));
+  int cq = chunked(block_position(s->y));
+  int cr = chunked(block_position(s->z));
+  return chunk_distance(p, q, r, cp, cq, cr) <=
+    g->render_radius * g->render_radius;
+}
+
+int chunk_ready(Chunk *chunk) {
+  // meshing before the neighbours arrive would emit their border faces
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dz = -1; dz <= 1; dz++) {
+        int p = chunk->p + dx;
+        int q = chunk->q + dy;
+        int r = chunk->r + dz;
+        if (!find_chunk(p, q, r) && chunk_in_radius(p, q, r)) {
+          return 0;
+        }
+      }
+    }
+  }
+  return 1;
+}
+
+int box_visible(float planes[6][4], int min[3], int max[3]) {
+  // blocks are two units wide and centered on even coordinates
+  float x0 = min[0] * 2 - 1, x1 = max[0] * 2 + 1;
+  float y0 = min[1] * 2 - 1, y1 = max[1] * 2 + 1;
+  float z0 = min[2] * 2 - 1, z1 = max[2] * 2 + 1;
+  float points[8][3] = {
+    {x0, y0, z0},
+    {x0, y0, z1},
+    {x0, y1, z0},
+    {x0, y1, z1},
+    {x1, y0, z0},
+    {x1, y0, z1},
+    {x1, y1, z0},
+    {x1, y1, z1}
+  };
+  // the near and far planes are meaningless for the orthographic view
+  int n = g->ortho ? 4 : 6;
+  for (int i = 0; i < n; i++) {
+    int in = 0;
+    int out = 0;
+    for (int j = 0; j < 8; j++) {
+      float d =
+        planes[i][0] * points[j][0] +
+        planes[i][1] * points[j][1] +
+        planes[i][2] * points[j][2] +
+        planes[i][3];
+      if (d < 0) {
+        out++;
+      }
+      else {
+        in++;
+      }
+      if (in && out) {
+        break;
+      }
+    }
+    if (in == 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int chunk_visible(float planes[6][4], Chunk *chunk) {
+  return box_visible(planes, chunk->min, chunk->max);
+}
+
+void camera_matrix(float *matrix) {
+  State *s = &g->camera.state;
+  set_matrix_3d(
+    matrix, g->width, g->height,
+    s->x, s->y, s->z, s->rx, s->ry, g->fov, g->ortho, g->render_radius);
+}
+
+void fill_chunk_padded(Chunk *chunk, unsigned char *blocks) {
+  Chunk *neighbours[27];
+  int index = 0;
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dz = -1; dz <= 1; dz++) {
+        neighbours[index++] = find_chunk(
+          chunk->p + dx, chunk->q + dy, chunk->r + dz);
+      }
+    }
+  }
+  chunk_fill_padded(neighbours, blocks);
+}
+
+int mesh_flags() {
+  return (g->greedy ? MESH_GREEDY : 0) | (g->packed ? MESH_PACKED : 0) |
+    (g->indexed ? MESH_INDEXED : 0);
+}
+
+void del_chunk_query(Chunk *chunk) {
+  if (chunk->query) {
+    glDeleteQueries(1, &chunk->query);
+    chunk->query = 0;
+    chunk->query_pending = 0;
+    chunk->query_stale = 0;
+  }
+}
+
+void del_chunk_buffer(Chunk *chunk) {
+  if (chunk->batched) {
+    Arena *arena = g->arenas + (chunk->flags & MESH_PACKED ? 1 : 0);
+    arena_release(arena, chunk->slab, chunk->offset, chunk->size);
+    chunk->batched = 0;
+  }
+  if (chunk->vao) {
+    del_vertex_array(chunk->vao);
+    chunk->vao = 0;
+  }
+  if (chunk->buffer) {
+    del_buffer(chunk->buffer);
+    chunk->buffer = 0;
+  }
+}
+
+void upload_chunk(Chunk *chunk, Mesh *mesh) {
+  del_chunk_buffer(chunk);
+  chunk->faces = mesh->faces;
+  chunk->skipped = mesh->skipped;
+  chunk->flags = mesh->flags;
+  chunk->size = mesh->size;
+  memcpy(chunk->min, mesh->min, sizeof(chunk->min));
+  memcpy(chunk->max, mesh->max, sizeof(chunk->max));
+  chunk->occluder_count = mesh->occluder_count;
+  memcpy(chunk->occluders, mesh->occluders,
+    sizeof(Occluder) * mesh->occluder_count);
+  if (mesh->faces) {
+    double start = glfwGetTime();
+    // meshes that do not fit in the arena keep a buffer of their own
+    int batch = g->batched &&
+      (g->base_vertex || !(mesh->flags & MESH_INDEXED));
+    if (batch) {
+      Arena *arena = g->arenas + (mesh->flags & MESH_PACKED ? 1 : 0);
+      chunk->slab = arena_alloc(arena, mesh->size, mesh->data, &chunk->offset);
+      chunk->batched = chunk->slab >= 0;
+    }
+    if (!chunk->batched) {
+      chunk->buffer = gen_buffer(mesh->size, mesh->data);
+    }
+    g->upload_total_time += glfwGetTime() - start;
+    g->upload_total_bytes += mesh->size;
+  }
+  free(mesh->data);
+}
+
+void gen_chunk_buffer(Chunk *chunk) {
+  static unsigned char blocks[PADDED_VOLUME];
+  fill_chunk_padded(chunk, blocks);
+  Mesh mesh;
+  mesh_chunk(&mesh, blocks,
+    chunk->p * CHUNK_SIZE, chunk->q * CHUNK_SIZE, chunk->r * CHUNK_SIZE,
+    mesh_flags());
+  chunk->dirty = 0;
+  upload_chunk(chunk, &mesh);
+}
+
+void dispatch_chunk(Chunk *chunk) {
+  // the worker meshes a private copy, so edits may continue meanwhile
+  MeshJob *job = (MeshJob *)malloc(sizeof(MeshJob));
+  job->p = chunk->p;
+  job->q = chunk->q;
+  job->r = chunk->r;
+  job->id = ++g->job_count;
+  job->flags = mesh_flags();
+  job->padded = (unsigned char *)malloc(PADDED_VOLUME);
+  fill_chunk_padded(chunk, job->padded);
+  chunk->dirty = 0;
+  chunk->pending = job->id;
+  g->jobs_in_flight++;
+  worker_pool_submit(&g->workers, job);
+}
+
+int _compare_priority(const void *a, const void *b) {
+  MeshJob *job1 = *(MeshJob **)a;
+  MeshJob *job2 = *(MeshJob **)b;
+  return job1->priority - job2->priority;
+}
+
+void receive_chunks() {
+  MeshJob *job;
+  while ((job = worker_pool_poll(&g->workers))) {
+    g->jobs_in_flight--;
+    if (g->ready_count == g->ready_capacity) {
+      g->ready_capacity = g->ready_capacity ? g->ready_capacity * 2 : 64;
+      g->ready = realloc(g->ready, sizeof(MeshJob *) * g->ready_capacity);
+    }
+    g->ready[g->ready_count++] = job;
+  }
+}
+
+void upload_chunks() {
+  // Finished meshes wait here until they fit in the frame's upload budget.
+  // Visible chunks go first, then nearer ones; the rest keep drawing
+  // their previous mesh.
+  float matrix[16];
+  float planes[6][4];
+  camera_matrix(matrix);
+  frustum_planes(planes, g->render_radius, matrix);
+  State *s = &g->camera.state;
+  int cp = chunked(block_position(s->x));
+  int cq = chunked(block_position(s->y));
+  int cr = chunked(block_position(s->z));
+  int count = 0;
+  for (int i = 0; i < g->ready_count; i++) {
+    MeshJob *job = g->ready[i];
+    Chunk *chunk = find_chunk(job->p, job->q, job->r);
+    // results for evicted chunks or superseded jobs are dropped
+    if (!chunk || chunk->pending != job->id) {
+      free(job->mesh.data);
+      free(job);
+      continue;
+    }
+    int visible = job->mesh.faces &&
+      box_visible(planes, job->mesh.min, job->mesh.max);
+    job->priority = chunk_distance(job->p, job->q, job->r, cp, cq, cr);
+    if (!visible) {
+      job->priority += 1 << 20;
+    }
+    g->ready[count++] = job;
+  }
+  g->ready_count = count;
+  qsort(g->ready, count, sizeof(MeshJob *), _compare_priority);
+  double start = glfwGetTime();
+  int bytes = 0;
+  int uploaded = 0;
+  for (; uploaded < count; uploaded++) {
+    MeshJob *job = g->ready[uploaded];
+    int size = job->mesh.size;
+    // empty meshes cost nothing, and at least one real upload always
+    // goes through so a single huge mesh cannot stall forever
+    if (size && bytes) {
+      double elapsed = glfwGetTime() - start;
+      if (bytes + size > UPLOAD_BUDGET_BYTES ||
+        elapsed * 1000 > UPLOAD_BUDGET_MS)
+      {
+        break;
+      }
+    }
+    Chunk *chunk = find_chunk(job->p, job->q, job->r);
+    chunk->pending = 0;
+    upload_chunk(chunk, &job->mesh);
+    bytes += size;
+    free(job);
+  }
+  memmove(g->ready, g->ready + uploaded,
+    sizeof(MeshJob *) * (count - uploaded));
+  g->ready_count = count - uploaded;
+  g->upload_count = uploaded;
+  g->upload_bytes = bytes;
+}
+
+void defrag_arena(Arena *arena, int packed) {
+  // Empties the most fragmented slab a few megabytes per frame, so its
+  // space comes back as one range. Without buffer copies the chunks are
+  // remeshed instead, once streaming is idle, and land in the first hole
+  // that fits.
+  int can_move = arena_can_move();
+  if (!can_move && (g->ready_count || g->jobs_in_flight)) {
+    return;
+  }
+  int slab = arena_fragmented_slab(arena, ARENA_DEFRAG_THRESHOLD);
+  if (slab < 0) {
+    return;
+  }
+  int moved = 0;
+  MAP_FOR_EACH(&g->chunks, entry) {
+    Chunk *chunk = (Chunk *)entry->value;
+    if (!chunk->batched || chunk->slab != slab ||
+      !(chunk->flags & MESH_PACKED) != !packed)
+    {
+      continue;
+    }
+    if (moved >= ARENA_DEFRAG_BYTES) {
+      break;
+    }
+    if (!can_move) {
+      if (!chunk->dirty && !chunk->pending) {
+        chunk->dirty = 1;
+        moved += chunk->size;
+      }
+      continue;
+    }
+    int offset;
+    int target = arena_move(arena, slab, chunk->offset, chunk->size, &offset);
+    if (target < 0) {
+      break;
+    }
+    chunk->slab = target;
+    chunk->offset = offset;
+    moved += chunk->size;
+  } END_MAP_FOR_EACH;
+}
+
+void update_chunks() {
+  receive_chunks();
+  upload_chunks();
+  for (int i = 0; i < 2; i++) {
+    defrag_arena(g->arenas + i, i);
+  }
+  MAP_FOR_EACH(&g->chunks, entry) {
+    Chunk *chunk = (Chunk *)entry->value;
+    if (!chunk->dirty || chunk->pending || !chunk_ready(chunk)) {
+      continue;
+    }
+    if (!g->threaded) {
+      gen_chunk_buffer(chunk);
+    }
+    else if (g->jobs_in_flight < QUEUE_SIZE) {
+      dispatch_chunk(chunk);
+    }
+  } END_MAP_FOR_EACH;
+}
+
+void use_block_program(Attrib *attrib, float *matrix, State *s) {
+  glUseProgram(attrib->program);
+  glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+  glUniform3f(attrib->camera, s->x, s->y, s->z);
+  glUniform1i(attrib->sampler, 0);
+  glUniform1i(attrib->extra1, 2);
+  glUniform1f(attrib->extra2, 0.5); //light
+  glUniform1f(attrib->extra3, g->render_radius * CHUNK_SIZE);
+  glUniform1i(attrib->extra4, g->ortho);
+  glUniform1f(attrib->timer, 0.1); // time of the day function
+}
+
+int _compare_occluders(const void *a, const void *b) {
+  return ((OccluderChunk *)a)->distance - ((OccluderChunk *)b)->distance;
+}
+
+void draw_occluders(float planes[6][4], float *matrix) {
+  // The solid boxes of the nearest chunks in view go into the CPU depth
+  // buffer; anything they cover is skipped by render_blocks.
+  State *s = &g->camera.state;
+  int cp = chunked(block_position(s->x));
+  int cq = chunked(block_position(s->y));
+  int cr = chunked(block_position(s->z));
+  g->occluder_count = 0;
+  MAP_FOR_EACH(&g->chunks, entry) {
+    Chunk *chunk = (Chunk *)entry->value;
+    if (!chunk->occluder_count) {
+      continue;
+    }
+    int min[3] = {
+      chunk->p * CHUNK_SIZE, chunk->q * CHUNK_SIZE, chunk->r * CHUNK_SIZE};
+    int max[3] = {
+      min[0] + CHUNK_SIZE - 1, min[1] + CHUNK_SIZE - 1,
+      min[2] + CHUNK_SIZE - 1};
+    if (!box_visible(planes, min, max)) {
+      continue;
+    }
+    if (g->occluder_count == g->occluder_capacity) {
+      g->occluder_capacity = g->occluder_capacity ?
+        g->occluder_capacity * 2 : 64;
+      g->occluders = (OccluderChunk *)realloc(
+        g->occluders, sizeof(OccluderChunk) * g->occluder_capacity);
+    }
+    OccluderChunk *o = g->occluders + g->occluder_count++;
+    o->chunk = chunk;
+    o->distance = chunk_distance(chunk->p, chunk->q, chunk->r, cp, cq, cr);
+  } END_MAP_FOR_EACH;
+  qsort(g->occluders, g->occluder_count, sizeof(OccluderChunk),
+    _compare_occluders);
+  g->occluder_count = MIN(g->occluder_count, OCCLUSION_CHUNKS);
+  OcclusionBuffer *buffer = &g->occlusion_buffer;
+  occlusion_clear(buffer, matrix, s->x, s->y, s->z);
+  for (int i = 0; i < g->occluder_count; i++) {
+    Chunk *chunk = g->occluders[i].chunk;
+    for (int j = 0; j < chunk->occluder_count; j++) {
+      Occluder *o = chunk->occluders + j;
+      float min[3], max[3];
+      for (int k = 0; k < 3; k++) {
+        min[k] = o->min[k] * 2 - 1;
+        max[k] = o->max[k] * 2 - 1;
+      }
+      occlusion_add_box(buffer, min, max);
+    }
+  }
+}
+
+int chunk_occluded(Chunk *chunk) {
+  float min[3], max[3];
+  for (int i = 0; i < 3; i++) {
+    min[i] = chunk->min[i] * 2 - 1;
+    max[i] = chunk->max[i] * 2 + 1;
+  }
+  return !occlusion_test_box(&g->occlusion_buffer, min, max);
+}
+
+int chunk_query_hidden(Chunk *chunk, State *s) {
+  // Results are read a frame or more after the query went out, so the
+  // CPU never waits for the GPU; until then the last answer stands. A
+  // chunk culled last frame may be back in plain view, so it is drawn
+  // and any answer still in flight for it is ignored.
+  if (chunk->query_frame != g->query_frame - 1) {
+    chunk->hidden = 0;
+    chunk->query_stale = chunk->query_pending;
+  }
+  chunk->query_frame = g->query_frame;
+  if (chunk->query_pending) {
+    GLuint available = 0;
+    glGetQueryObjectuiv(chunk->query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint samples = 0;
+      glGetQueryObjectuiv(chunk->query, GL_QUERY_RESULT, &samples);
+      if (!chunk->query_stale) {
+        chunk->hidden = !samples;
+      }
+      chunk->query_pending = 0;
+      chunk->query_stale = 0;
+    }
+  }
+  // from inside its box the faces of a chunk would be clipped away
+  int inside = 1;
+  float p[3] = {s->x, s->y, s->z};
+  for (int i = 0; i < 3; i++) {
+    inside = inside &&
+      p[i] > chunk->min[i] * 2 - 3 && p[i] < chunk->max[i] * 2 + 3;
+  }
+  if (inside) {
+    chunk->hidden = 0;
+    return 0;
+  }
+  if (!chunk->query_pending) {
+    if (g->query_count == g->query_capacity) {
+      g->query_capacity = g->query_capacity ? g->query_capacity * 2 : 64;
+      g->query_chunks = (Chunk **)realloc(
+        g->query_chunks, sizeof(Chunk *) * g->query_capacity);
+    }
+    g->query_chunks[g->query_count++] = chunk;
+  }
+  return chunk->hidden;
+}
+
+void draw_chunk_conditional(Attrib *attrib, Chunk *chunk) {
+  // a chunk still waiting on its query lets the GPU skip it if the
+  // answer arrives in time, unless that answer is stale
+  int conditional = g->queries && chunk->query_pending &&
+    !chunk->query_stale && has_conditional_render();
+  if (conditional) {
+    begin_conditional_render(chunk->query);
+    g->conditional_count++;
+  }
+  draw_chunk(attrib, chunk);
+  if (conditional) {
+    end_conditional_render();
+  }
+}
+
+GLuint gen_box_buffer() {
+  // corner i of the unit cube is (i >> 2 & 1, i >> 1 & 1, i & 1)
+  static const int faces[6][4] = {
+    {0, 1, 3, 2}, {4, 5, 7, 6}, {0, 1, 5, 4},
+    {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 3, 7, 5}
+  };
+  static const int triangles[6] = {0, 1, 2, 0, 2, 3};
+  GLfloat data[6 * 6 * 3];
+  GLfloat *d = data;
+  for (int i = 0; i < 6; i++) {
+    for (int j = 0; j < 6; j++) {
+      int corner = faces[i][triangles[j]];
+      *(d++) = corner >> 2 & 1;
+      *(d++) = corner >> 1 & 1;
+      *(d++) = corner & 1;
+    }
+  }
+  return gen_buffer(sizeof(data), data);
+}
+
+void render_queries(Attrib *attrib) {
+  // Bounding boxes are tested against the finished depth buffer with
+  // color and depth writes off. Both sides are drawn, so a box seen from
+  // any angle counts, and they are pushed out a little so a chunk's own
+  // faces do not hide its box.
+  int count = g->query_count;
+  g->query_count = 0;
+  if (!count) {
+    return;
+  }
+  float matrix[16];
+  camera_matrix(matrix);
+  glUseProgram(attrib->program);
+  glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+  if (!g->query_buffer) {
+    g->query_buffer = gen_box_buffer();
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, g->query_buffer);
+  glEnableVertexAttribArray(attrib->position);
+  glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+  glDepthFunc(GL_LEQUAL);
+  glDisable(GL_CULL_FACE);
+  GLenum target = occlusion_query_target();
+  for (int i = 0; i < count; i++) {
+    Chunk *chunk = g->query_chunks[i];
+    if (!chunk->query) {
+      glGenQueries(1, &chunk->query);
+    }
+    float margin = 0.05;
+    glUniform3f(attrib->extra1,
+      chunk->min[0] * 2 - 1 - margin, chunk->min[1] * 2 - 1 - margin,
+      chunk->min[2] * 2 - 1 - margin);
+    glUniform3f(attrib->extra2,
+      (chunk->max[0] - chunk->min[0] + 1) * 2 + margin * 2,
+      (chunk->max[1] - chunk->min[1] + 1) * 2 + margin * 2,
+      (chunk->max[2] - chunk->min[2] + 1) * 2 + margin * 2);
+    glBeginQuery(target, chunk->query);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glEndQuery(target);
+    chunk->query_pending = 1;
+  }
+  glEnable(GL_CULL_FACE);
+  glDepthFunc(GL_LESS);
+  glDepthMask(GL_TRUE);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDisableVertexAttribArray(attrib->position);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void render_blocks(Attrib *attrib, Attrib *packed_attrib, Camera *camera) {
+  State *s = &camera->state;
+  float matrix[16];
+  camera_matrix(matrix);
+
+  float planes[6][4];
+  frustum_planes(planes, g->render_radius, matrix);
+  use_block_program(attrib, matrix, s);
+
+  g->face_count = 0;
+  g->skipped_count = 0;
+  g->tested_count = 0;
+  g->culled_count = 0;
+  g->drawn_count = 0;
+  g->vertex_count = 0;
+  g->vertex_bytes = 0;
+  g->draw_calls = 0;
+  g->uniform_count = 0;
+  g->block_bytes = 0;
+  g->occluded_count = 0;
+  g->query_count = 0;
+  g->query_hidden_count = 0;
+  g->conditional_count = 0;
+  g->query_frame++;
+  if (g->occlusion) {
+    double start = glfwGetTime();
+    draw_occluders(planes, matrix);
+    frame_histogram_add(&g->occlusion_times, glfwGetTime() - start);
+  }
+  int packed_count = 0;
+  MAP_FOR_EACH(&g->chunks, entry) {
+    Chunk *chunk = (Chunk *)entry->value;
+    chunk->visible = 0;
+    g->uniform_count += !chunk->bits;
+    g->block_bytes += chunk_block_memory(chunk);
+    g->face_count += chunk->faces;
+    g->skipped_count += chunk->skipped;
+    g->vertex_count += chunk->faces * mesh_face_vertices(chunk->flags);
+    g->vertex_bytes += chunk->size;
+    if (!chunk->faces) {
+      continue;
+    }
+    g->tested_count++;
+    if (!chunk_visible(planes, chunk)) {
+      g->culled_count++;
+      continue;
+    }
+    if (g->occlusion && chunk_occluded(chunk)) {
+      g->occluded_count++;
+      continue;
+    }
+    if (g->queries && chunk_query_hidden(chunk, s)) {
+      g->query_hidden_count++;
+      continue;
+    }
+    chunk->visible = 1;
+    g->drawn_count++;
+    if (chunk->flags & MESH_PACKED) {
+      packed_count++;
+    }
+    else if (chunk->batched) {
+      batch_add(chunk);
+    }
+    else {
+      draw_chunk_conditional(attrib, chunk);
+    }
+  } END_MAP_FOR_EACH;
+  flush_batch(attrib, batch_index(0));
+  flush_batch(attrib, batch_index(MESH_INDEXED));
+  if (packed_count) {
+    // packed vertices are chunk-local, so each draw sets the chunk origin
+    use_block_program(packed_attrib, matrix, s);
+    MAP_FOR_EACH(&g->chunks, entry) {
+      Chunk *chunk = (Chunk *)entry->value;
+      if (!chunk->visible || !(chunk->flags & MESH_PACKED)) {
+        continue;
+      }
+      if (chunk->batched) {
+        batch_add(chunk);
+        continue;
+      }
+      glUniform3f(packed_attrib->extra5,
+        chunk->p * CHUNK_SIZE, chunk->q * CHUNK_SIZE, chunk->r * CHUNK_SIZE);
+      draw_chunk_conditional(packed_attrib, chunk);
+    } END_MAP_FOR_EACH;
+    flush_batch(packed_attrib, batch_index(MESH_PACKED));
+    flush_batch(packed_attrib, batch_index(MESH_PACKED | MESH_INDEXED));
+  }
+  if (g->vertex_arrays) {
+    bind_vertex_array(0);
+  }
+}
+
+void update_entities(double dt) {
+  for (int i = 0; i < g->entity_count; i++) {
+    Entity *entity = g->entities + i;
+    float *p[3] = {&entity->state.x, &entity->state.y, &entity->state.z};
+    for (int j = 0; j < 3; j++) {
+      *p[j] += entity->velocity[j] * dt;
+      float d = *p[j] - entity->home[j];
+      if (ABS(d) > ENTITY_RANGE / 2 && SIGN(d) == SIGN(entity->velocity[j])) {
+        entity->velocity[j] = -entity->velocity[j];
+      }
+    }
+    entity->state.rx += entity->spin * dt;
+  }
+}
+
+int gen_instance_data() {
+  int count = g->player_count + g->entity_count;
+  if (count > g->instance_capacity) {
+    g->instance_capacity = MAX(g->instance_capacity * 2, count);
+    g->instance_data = realloc(g->instance_data,
+      sizeof(GLfloat) * INSTANCE_COMPONENTS * g->instance_capacity);
+  }
+  GLfloat *d = g->instance_data;
+  for (int i = 0; i < count; i++) {
+    State *s;
+    float tiles = 0;
+    if (i < g->player_count) {
+      s = &g->players[i].state;
+    }
+    else {
+      Entity *entity = g->entities + i - g->player_count;
+      s = &entity->state;
+      tiles = entity->tiles;
+    }
+    *(d++) = s->x;
+    *(d++) = s->y;
+    *(d++) = s->z;
+    *(d++) = s->rx;
+    *(d++) = s->ry;
+    *(d++) = tiles;
+  }
+  return count;
+}
+
+void render_entities(Attrib *attrib, Camera *camera) {
+  // Players and entities share one cube mesh; each instance carries only
+  // its position, rotation and tiles, and the shader places the cube.
+  int count = gen_instance_data();
+  g->entity_draws = 0;
+  if (!count) {
+    return;
+  }
+  State *s = &camera->state;
+  float matrix[16];
+  camera_matrix(matrix);
+  use_block_program(attrib, matrix, s);
+  if (!g->entity_buffer) {
+    GLfloat *data = malloc_faces(10, 6);
+    make_player_cube(data);
+    g->entity_buffer = gen_faces(10, 6, data);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, g->entity_buffer);
+  glEnableVertexAttribArray(attrib->position);
+  glEnableVertexAttribArray(attrib->normal);
+  glEnableVertexAttribArray(attrib->uv);
+  glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
+      sizeof(GLfloat) * 10, 0);
+  glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
+      sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
+  glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
+      sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
+  if (g->instanced) {
+    int size = sizeof(GLfloat) * INSTANCE_COMPONENTS * count;
+    if (!g->instance_buffer) {
+      glGenBuffers(1, &g->instance_buffer);
+    }
+    g->instance_buffer_size = MAX(g->instance_buffer_size, size);
+    glBindBuffer(GL_ARRAY_BUFFER, g->instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, g->instance_buffer_size, NULL,
+      GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, g->instance_data);
+    glEnableVertexAttribArray(attrib->instance);
+    glEnableVertexAttribArray(attrib->orientation);
+    glVertexAttribPointer(attrib->instance, 3, GL_FLOAT, GL_FALSE,
+        sizeof(GLfloat) * INSTANCE_COMPONENTS, 0);
+    glVertexAttribPointer(attrib->orientation, 3, GL_FLOAT, GL_FALSE,
+        sizeof(GLfloat) * INSTANCE_COMPONENTS,
+        (GLvoid *)(sizeof(GLfloat) * 3));
+    vertex_attrib_divisor(attrib->instance, 1);
+    vertex_attrib_divisor(attrib->orientation, 1);
+    draw_arrays_instanced(GL_TRIANGLES, 0, 36, count);
+    vertex_attrib_divisor(attrib->instance, 0);
+    vertex_attrib_divisor(attrib->orientation, 0);
+    glDisableVertexAttribArray(attrib->instance);
+    glDisableVertexAttribArray(attrib->orientation);
+    g->entity_draws = 1;
+  }
+  else {
+    // without instancing the same attributes are set as constants per draw
+    GLfloat *d = g->instance_data;
+    for (int i = 0; i < count; i++, d += INSTANCE_COMPONENTS) {
+      glVertexAttrib3f(attrib->instance, d[0], d[1], d[2]);
+      glVertexAttrib3f(attrib->orientation, d[3], d[4], d[5]);
+      glDrawArrays(GL_TRIANGLES, 0, 36);
+    }
+    g->entity_draws = count;
+  }
+  glDisableVertexAttribArray(attrib->position);
+  glDisableVertexAttribArray(attrib->normal);
+  glDisableVertexAttribArray(attrib->uv);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void begin_text() {
+  g->text_frame++;
+  g->text_count = 0;
+  g->text_strings = 0;
+  g->text_glyphs = 0;
+}
+
+unsigned int hash_text(const char *text, int length) {
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+  }
+  return hash;
+}
+
+TextLine *find_text_line(int justify, float x, float y, float n) {
+  // lines are keyed by where they are drawn, the least recently drawn
+  // one is reused for a new place
+  TextLine *oldest = g->text_lines;
+  for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+    TextLine *line = g->text_lines + i;
+    if (line->frame && line->justify == justify &&
+      line->x == x && line->y == y && line->n == n)
+    {
+      return line;
+    }
+    if (line->frame < oldest->frame) {
+      oldest = line;
+    }
+  }
+  oldest->justify = justify;
+  oldest->x = x;
+  oldest->y = y;
+  oldest->n = n;
+  oldest->length = -1;
+  return oldest;
+}
+
+void make_text(GLfloat *data, int justify, float x, float y, float n,
+  const char *text, int length, int start, int end)
+{
+  x -= n * justify * (length - 1) / 2;
+  for (int i = start; i < end; i++) {
+    make_character(data + i * 24, x + i * n, y, n / 2, n, text[i]);
+  }
+}
+
+void update_text_line(TextLine *line, const char *text, int length) {
+  // Left aligned glyphs keep their place as the length changes, so only
+  // the span between the first and last differing character, usually a
+  // few digits, is rebuilt.
+  int start = 0;
+  int end = length;
+  if (line->length >= 0 &&
+    (line->justify == ALIGN_LEFT || length == line->length))
+  {
+    int shared = MIN(length, line->length);
+    while (start < shared && text[start] == line->text[start]) {
+      start++;
+    }
+    while (end > start && end <= line->length &&
+      text[end - 1] == line->text[end - 1])
+    {
+      end--;
+    }
+  }
+  make_text(line->data, line->justify, line->x, line->y, line->n,
+    text, length, start, end);
+  g->text_glyphs += end - start;
+  memcpy(line->text, text, length);
+  line->length = length;
+  line->hash = hash_text(text, length);
+}
+
+void add_text(int justify, float x, float y, float n, char *text) {
+  int length = MIN(strlen(text), MAX_TEXT_LENGTH);
+  if (g->text_count + length > g->text_capacity) {
+    g->text_capacity = MAX(g->text_capacity * 2, g->text_count + length);
+    g->text_data = realloc(
+      g->text_data, sizeof(GLfloat) * 24 * g->text_capacity);
+  }
+  GLfloat *data = g->text_data + g->text_count * 24;
+  g->text_count += length;
+  g->text_strings++;
+  if (!g->text_cache) {
+    make_text(data, justify, x, y, n, text, length, 0, length);
+    g->text_glyphs += length;
+    return;
+  }
+  TextLine *line = find_text_line(justify, x, y, n);
+  line->frame = g->text_frame;
+  if (length != line->length || hash_text(text, length) != line->hash ||
+    memcmp(text, line->text, length))
+  {
+    update_text_line(line, text, length);
+  }
+  memcpy(data, line->data, sizeof(GLfloat) * 24 * length);
+}
+
+void flush_text(Attrib *attrib) {
+  // All of the frame's strings go out in one draw from a streaming
+  // buffer. Respecifying its storage before the write orphans last
+  // frame's copy, so the driver never waits for it to be drawn.
+  if (!g->text_count) {
+    return;
+  }
+  glUseProgram(attrib->program);
+  if (g->text_width != g->width || g->text_height != g->height) {
+    float matrix[16];
+    set_matrix_2d(matrix, g->width, g->height);
+    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+    glUniform1i(attrib->sampler, 1);
+    glUniform1i(attrib->extra1, 0);
+    g->text_width = g->width;
+    g->text_height = g->height;
+  }
+  int size = sizeof(GLfloat) * 24 * g->text_count;
+  if (!g->text_buffer) {
+    glGenBuffers(1, &g->text_buffer);
+  }
+  g->text_buffer_size = MAX(g->text_buffer_size, size);
+  glBindBuffer(GL_ARRAY_BUFFER, g->text_buffer);
+  glBufferData(GL_ARRAY_BUFFER, g->text_buffer_size, NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, size, g->text_data);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  if (g->vertex_arrays) {
+    if (!g->text_vao) {
+      g->text_vao = gen_vertex_array();
+      bind_vertex_array(g->text_vao);
+      glBindBuffer(GL_ARRAY_BUFFER, g->text_buffer);
+      glEnableVertexAttribArray(attrib->position);
+      glEnableVertexAttribArray(attrib->uv);
+      glVertexAttribPointer(attrib->position, 2, GL_FLOAT, GL_FALSE,
+          sizeof(GLfloat) * 4, 0);
+      glVertexAttribPointer(attrib->uv, 2, GL_FLOAT, GL_FALSE,
+          sizeof(GLfloat) * 4, (GLvoid *)(sizeof(GLfloat) * 2));
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    else {
+      bind_vertex_array(g->text_vao);
+    }
+    glDrawArrays(GL_TRIANGLES, 0, g->text_count * 6);
+    bind_vertex_array(0);
+  }
+  else {
+    draw_triangles_2d(attrib, g->text_buffer, g->text_count * 6);
+  }
+  glDisable(GL_BLEND);
+}
+
+void model_setup(){
+  map_alloc(&g->chunks, 0xff);
+  g->chunk_count = 0;
+  g->chunk_memory = 0;
+  g->edit_memory = 0;
+  g->uniform_count = 0;
+  g->block_bytes = 0;
+  map_alloc(&g->edits, 0xff);
+  map_alloc(&g->columns, 0xff);
+  memset(g->players, 0, sizeof(Player) * MAX_PLAYERS);
+  g->player_count = 0;
+  g->flying = 1;
+  g->greedy = 0;
+  g->packed = 0;
+  g->indexed = 0;
+  g->vertex_arrays = has_vertex_arrays();
+  g->batched = 1;
+  // indexed meshes can only share a buffer when draws take a base vertex
+  g->base_vertex = GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex;
+  for (int i = 0; i < 2; i++) {
+    arena_init(g->arenas + i, ARENA_SLAB_SIZE);
+  }
+  memset(g->batches, 0, sizeof(g->batches));
+  g->text_vao = 0;
+  g->text_cache = 1;
+  g->text_frame = 0;
+  g->text_width = 0;
+  g->text_height = 0;
+  memset(g->text_lines, 0, sizeof(g->text_lines));
+  g->text_data = NULL;
+  g->text_count = 0;
+  g->text_capacity = 0;
+  g->text_strings = 0;
+  g->text_buffer = 0;
+  g->text_buffer_size = 0;
+  frame_histogram_reset(&g->text_times);
+  frame_histogram_reset(&g->draw_times);
+  g->raycast_benchmark = 0;
+  g->ray_rate = 0;
+  g->ray_hits = 0;
+  g->height_benchmark = 0;
+  g->height_rate = 0;
+  g->scan_rate = 0;
+  g->occlusion = 1;
+  occlusion_init(&g->occlusion_buffer, OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+  g->occluders = NULL;
+  g->occluder_count = 0;
+  g->occluder_capacity = 0;
+  g->occluded_count = 0;
+  frame_histogram_reset(&g->occlusion_times);
+  g->queries = 0;
+  g->query_chunks = NULL;
+  g->query_count = 0;
+  g->query_capacity = 0;
+  g->query_buffer = 0;
+  g->query_hidden_count = 0;
+  g->conditional_count = 0;
+  g->query_frame = 0;
+  g->entities = NULL;
+  g->entity_count = 0;
+  g->entity_capacity = 0;
+  g->instanced = has_instancing();
+  g->entity_buffer = 0;
+  g->instance_data = NULL;
+  g->instance_capacity = 0;
+  g->instance_buffer = 0;
+  g->instance_buffer_size = 0;
+  g->entity_draws = 0;
+  frame_histogram_reset(&g->entity_times);
+  g->upload_total_bytes = 0;
+  g->upload_total_time = 0;
+  g->threaded = 1;
+  g->job_count = 0;
+  g->jobs_in_flight = 0;
+  g->ready = NULL;
+  g->ready_count = 0;
+  g->ready_capacity = 0;
+  frame_histogram_reset(&g->frames);
+  g->ortho = 0;
+  g->fov = 65;
+  g->render_radius = RENDER_CHUNK_RADIUS;
+}
+
+Chunk *create_chunk(int p, int q, int r) {
+  Chunk *chunk = (Chunk *)malloc(sizeof(Chunk));
+  chunk_init(chunk, p, q, r);
+  map_set(&g->chunks, p, q, r, chunk);
+  g->chunk_count++;
+  return chunk;
+}
+
+void dirty_chunk_neighbours(int x, int y, int z) {
+  // a block on a chunk border changes the exposed faces of the chunk next
+  // to it, and one up to SHADE_HEIGHT into a chunk shades the one below
+  int p = chunked(x);
+  int q = chunked(y);
+  int r = chunked(z);
+  int lx = x - p * CHUNK_SIZE;
+  int ly = y - q * CHUNK_SIZE;
+  int lz = z - r * CHUNK_SIZE;
+  for (int dx = -1; dx <= 1; dx++) {
+    if ((dx < 0 && lx != 0) || (dx > 0 && lx != CHUNK_SIZE - 1)) continue;
+    for (int dy = -1; dy <= 1; dy++) {
+      if ((dy < 0 && ly > SHADE_HEIGHT) || (dy > 0 && ly != CHUNK_SIZE - 1)) {
+        continue;
+      }
+      for (int dz = -1; dz <= 1; dz++) {
+        if ((dz < 0 && lz != 0) || (dz > 0 && lz != CHUNK_SIZE - 1)) continue;
+        Chunk *other = find_chunk(p + dx, q + dy, r + dz);
+        if (other) {
+          other->dirty = 1;
+        }
+      }
+    }
+  }
+}
+
+int column_scan(int p, int r, int q, int x, int z) {
+  // highest solid block at local x, z in chunk q or any loaded chunk below
+  Column *column = (Column *)map_get(&g->columns, p, 0, r);
+  for (; q >= column->q_min; q--) {
+    Chunk *chunk = find_chunk(p, q, r);
+    if (chunk && chunk->heights[z * CHUNK_SIZE + x] >= 0) {
+      return q * CHUNK_SIZE + chunk->heights[z * CHUNK_SIZE + x];
+    }
+  }
+  return NO_HEIGHT;
+}
+
+void column_add(Chunk *chunk) {
+  Column *column = (Column *)map_get(&g->columns, chunk->p, 0, chunk->r);
+  if (!column) {
+    column = (Column *)malloc(sizeof(Column));
+    for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+      column->heights[i] = NO_HEIGHT;
+    }
+    column->q_min = column->q_max = chunk->q;
+    column->chunks = 0;
+    map_set(&g->columns, chunk->p, 0, chunk->r, column);
+  }
+  column->q_min = MIN(column->q_min, chunk->q);
+  column->q_max = MAX(column->q_max, chunk->q);
+  column->chunks++;
+  for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+    if (chunk->heights[i] >= 0) {
+      column->heights[i] = MAX(column->heights[i],
+        chunk->q * CHUNK_SIZE + chunk->heights[i]);
+    }
+  }
+}
+
+void column_remove(Chunk *chunk) {
+  // call after the chunk has left g->chunks
+  Column *column = (Column *)map_get(&g->columns, chunk->p, 0, chunk->r);
+  if (--column->chunks == 0) {
+    map_remove(&g->columns, chunk->p, 0, chunk->r);
+    free(column);
+    return;
+  }
+  // some chunk of the column is still loaded, so both loops stop
+  while (!find_chunk(chunk->p, column->q_min, chunk->r)) {
+    column->q_min++;
+  }
+  while (!find_chunk(chunk->p, column->q_max, chunk->r)) {
+    column->q_max--;
+  }
+  // only cells topped by this chunk change, and nothing loaded above it
+  // is solid there
+  for (int z = 0; z < CHUNK_SIZE; z++) {
+    for (int x = 0; x < CHUNK_SIZE; x++) {
+      int *height = column->heights + z * CHUNK_SIZE + x;
+      if (*height != NO_HEIGHT && chunked(*height) == chunk->q) {
+        *height = column_scan(chunk->p, chunk->r, chunk->q - 1, x, z);
+      }
+    }
   }
 }
 
-void on_mouse_button(GLFWwindow *window, int button, int action, int mods) {
-  int control = mods & (GLFW_MOD_CONTROL | GLFW_MOD_SUPER);
-  int exclusive = glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_DISABLED;
+void column_update(Chunk *chunk, int x, int y, int z, int w) {
+  // after chunk_add_block has written w at world x, y, z
+  Column *column = (Column *)map_get(&g->columns, chunk->p, 0, chunk->r);
+  int lx = x - chunk->p * CHUNK_SIZE;
+  int lz = z - chunk->r * CHUNK_SIZE;
+  int *height = column->heights + lz * CHUNK_SIZE + lx;
+  if (w && y > *height) {
+    *height = y;
+  }
+  else if (!w && y == *height) {
+    *height = column_scan(chunk->p, chunk->r, chunk->q, lx, lz);
+  }
+}
 
-  if (action != GLFW_PRESS) return;
+int get_block(int x, int y, int z) {
+  // air where the chunk is not loaded
+  int p = chunked(x);
+  int q = chunked(y);
+  int r = chunked(z);
+  Chunk *chunk = find_chunk(p, q, r);
+  if (!chunk) {
+    return 0;
+  }
+  return chunk_get_block(chunk,
+    x - p * CHUNK_SIZE, y - q * CHUNK_SIZE, z - r * CHUNK_SIZE);
+}
 
-  if (button == GLFW_MOUSE_BUTTON_LEFT && exclusive) {
-    printf("LEFT BUTTON CLICK\n");
+void set_block(int x, int y, int z, int w) {
+  // edits outlive the chunk so they are reapplied when it loads again
+  if (w < 0 || w > 255) {
+    // chunk palettes and edit maps hold 8 bit block ids
+    return;
+  }
+  int p = chunked(x);
+  int q = chunked(y);
+  int r = chunked(z);
+  Chunk *chunk = find_chunk(p, q, r);
+  if (chunk && get_block(x, y, z) == w) {
+    return;
+  }
+  EditMap *edits = (EditMap *)map_get(&g->edits, p, q, r);
+  if (!edits) {
+    edits = (EditMap *)calloc(1, sizeof(EditMap));
+    map_set(&g->edits, p, q, r, edits);
+  }
+  else {
+    g->edit_memory -= edit_map_memory(edits);
   }
+  edit_map_set(edits,
+    x - p * CHUNK_SIZE, y - q * CHUNK_SIZE, z - r * CHUNK_SIZE, w);
+  g->edit_memory += edit_map_memory(edits);
+  if (chunk) {
+    chunk_add_block(chunk, x, y, z, w);
+    column_update(chunk, x, y, z, w);
+    dirty_chunk_neighbours(x, y, z);
+  }
+}
 
-  if (button == GLFW_MOUSE_BUTTON_RIGHT && exclusive) {
-    printf("RIGHT BUTTON CLICK\n");
+int highest_block(float x, float z) {
+  // block y of the top loaded solid block under world x, z, or NO_HEIGHT
+  int bx = block_position(x);
+  int bz = block_position(z);
+  int p = chunked(bx);
+  int r = chunked(bz);
+  Column *column = (Column *)map_get(&g->columns, p, 0, r);
+  if (!column) {
+    return NO_HEIGHT;
   }
+  return column->heights[
+    (bz - r * CHUNK_SIZE) * CHUNK_SIZE + (bx - p * CHUNK_SIZE)];
 }
 
-int get_scale_factor() {
-  int window_width, window_height;
-  int buffer_width, buffer_height;
-  glfwGetWindowSize(g->window, &window_width, &window_height);
-  glfwGetFramebufferSize(g->window, &buffer_width, &buffer_height);
-  int result = buffer_width / window_width;
-  result = MAX(1, result);
-  result = MIN(2, result);
-  return result;
+int scan_highest_block(float x, float z) {
+  // highest_block without the cache, block by block from the top chunk
+  int bx = block_position(x);
+  int bz = block_position(z);
+  Column *column = (Column *)map_get(
+    &g->columns, chunked(bx), 0, chunked(bz));
+  if (!column) {
+    return NO_HEIGHT;
+  }
+  int bottom = column->q_min * CHUNK_SIZE;
+  for (int y = column->q_max * CHUNK_SIZE + CHUNK_SIZE - 1; y >= bottom; y--) {
+    if (get_block(bx, y, bz)) {
+      return y;
+    }
+  }
+  return NO_HEIGHT;
 }
 
-void draw_triangles_2d(Attrib *attrib, GLuint buffer, int count) {
-  glBindBuffer(GL_ARRAY_BUFFER, buffer);
-  glEnableVertexAttribArray(attrib->position);
-  glEnableVertexAttribArray(attrib->uv);
-  glVertexAttribPointer(attrib->position, 2, GL_FLOAT, GL_FALSE,
-      sizeof(GLfloat) * 4, 0);
-  glVertexAttribPointer(attrib->uv, 2, GL_FLOAT, GL_FALSE,
-      sizeof(GLfloat) * 4, (GLvoid *)(sizeof(GLfloat) * 2));
-  glDrawArrays(GL_TRIANGLES, 0, count);
-  glDisableVertexAttribArray(attrib->position);
-  glDisableVertexAttribArray(attrib->uv);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+void get_sight_vector(float rx, float ry, float *vx, float *vy, float *vz) {
+  float m = cosf(ry);
+  *vx = cosf(rx - RADIANS(90)) * m;
+  *vy = sinf(ry);
+  *vz = sinf(rx - RADIANS(90)) * m;
 }
 
-void draw_triangles_3d_ao(Attrib *attrib, GLuint buffer, int count) {
-  glBindBuffer(GL_ARRAY_BUFFER, buffer);
-  glEnableVertexAttribArray(attrib->position);
-  glEnableVertexAttribArray(attrib->normal);
-  glEnableVertexAttribArray(attrib->uv);
-  glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
-      sizeof(GLfloat) * 10, 0);
-  glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
-      sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
-  glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
-      sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
-  glDrawArrays(GL_TRIANGLES, 0, count);
-  glDisableVertexAttribArray(attrib->position);
-  glDisableVertexAttribArray(attrib->normal);
-  glDisableVertexAttribArray(attrib->uv);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+typedef struct {
+  int x;
+  int y;
+  int z;
+  int w;
+  // face of the block the ray entered through, numbered as in the
+  // mesher, or -1 when it starts inside the block
+  int face;
+  // world units from the ray origin
+  float distance;
+} RayHit;
+
+int raycast(
+  float x, float y, float z, float vx, float vy, float vz, float reach,
+  RayHit *hit)
+{
+  // Amanatides-Woo traversal: visit exactly the blocks the ray passes
+  // through, always stepping across the nearest of the three next block
+  // boundaries. Blocks are two world units wide, so every boundary
+  // crossing along an axis is 2 / |v| further along the ray.
+  static const int entry_faces[3][2] = {{1, 0}, {2, 3}, {5, 4}};
+  float length = sqrtf(vx * vx + vy * vy + vz * vz);
+  if (length == 0) {
+    return 0;
+  }
+  float origin[3] = {x / 2, y / 2, z / 2};
+  float v[3] = {vx / length, vy / length, vz / length};
+  int cell[3];
+  int step[3];
+  float t_max[3];
+  float t_delta[3];
+  for (int i = 0; i < 3; i++) {
+    cell[i] = roundf(origin[i]);
+    if (v[i] > 0) {
+      step[i] = 1;
+      t_max[i] = (cell[i] + 0.5 - origin[i]) * 2 / v[i];
+      t_delta[i] = 2 / v[i];
+    }
+    else if (v[i] < 0) {
+      step[i] = -1;
+      t_max[i] = (origin[i] - cell[i] + 0.5) * 2 / -v[i];
+      t_delta[i] = 2 / -v[i];
+    }
+    else {
+      step[i] = 0;
+      t_max[i] = INFINITY;
+      t_delta[i] = INFINITY;
+    }
+  }
+  // the chunk lookup is repeated only when the ray crosses into another
+  Chunk *chunk = NULL;
+  int p = 0;
+  int q = 0;
+  int r = 0;
+  int face = -1;
+  int axis = 0;
+  float t = 0;
+  for (int i = 0; t <= reach; i++) {
+    int cp = chunked(cell[0]);
+    int cq = chunked(cell[1]);
+    int cr = chunked(cell[2]);
+    if (i == 0 || cp != p || cq != q || cr != r) {
+      chunk = find_chunk(cp, cq, cr);
+      p = cp;
+      q = cq;
+      r = cr;
+    }
+    int w = chunk ? chunk_get_block(chunk,
+      cell[0] - p * CHUNK_SIZE, cell[1] - q * CHUNK_SIZE,
+      cell[2] - r * CHUNK_SIZE) : 0;
+    if (w > 0) {
+      hit->x = cell[0];
+      hit->y = cell[1];
+      hit->z = cell[2];
+      hit->w = w;
+      hit->face = face;
+      hit->distance = t;
+      return w;
+    }
+    axis = t_max[0] < t_max[1] ?
+      (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+    t = t_max[axis];
+    cell[axis] += step[axis];
+    t_max[axis] += t_delta[axis];
+    face = entry_faces[axis][step[axis] > 0];
+  }
+  return 0;
 }
 
-GLuint gen_player_buffer(float x, float y, float z, float rx, float ry) {
-  GLfloat *data = malloc_faces(10, 6);
-  make_player(data, x, y, z, rx, ry);
-  return gen_faces(10, 6, data);
+int hit_test(
+  int previous, float x, float y, float z, float rx, float ry,
+  int *hx, int *hy, int *hz)
+{
+  // The block under the crosshair, or with previous the empty block in
+  // front of the face the sight line hits.
+  float vx, vy, vz;
+  get_sight_vector(rx, ry, &vx, &vy, &vz);
+  RayHit hit;
+  if (!raycast(x, y, z, vx, vy, vz, HIT_DISTANCE * 2, &hit)) {
+    return 0;
+  }
+  *hx = hit.x;
+  *hy = hit.y;
+  *hz = hit.z;
+  if (previous) {
+    static const int normals[6][3] = {
+      {-1, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, -1}, {0, 0, 1}
+    };
+    if (hit.face < 0) {
+      return 0;
+    }
+    *hx += normals[hit.face][0];
+    *hy += normals[hit.face][1];
+    *hz += normals[hit.face][2];
+  }
+  return hit.w;
 }
 
-GLuint gen_cube_buffer(float x, float y, float z, float n, int w) {
-  GLfloat *data = malloc_faces(10, 6);
-  float ao[6][4] = {0};
-  float light[6][4] = {
-      {0.5, 0.5, 0.5, 0.5},
-      {0.5, 0.5, 0.5, 0.5},
-      {0.5, 0.5, 0.5, 0.5},
-      {0.5, 0.5, 0.5, 0.5},
-      {0.5, 0.5, 0.5, 0.5},
-      {0.5, 0.5, 0.5, 0.5}
-  };
-  make_cube(data, ao, light, 1, 1, 1, 1, 1, 1, x * 2, y * 2, z * 2, n, w);
-  return gen_faces(10, 6, data);
+void raycast_benchmark() {
+  // rays in random directions from the camera, as line of sight checks
+  // between nearby points would be
+  State *s = &g->camera.state;
+  float (*directions)[3] = malloc(sizeof(float) * 3 * RAYCAST_BENCHMARK_RAYS);
+  for (int i = 0; i < RAYCAST_BENCHMARK_RAYS; i++) {
+    for (int j = 0; j < 3; j++) {
+      directions[i][j] = random_range(-1, 1);
+    }
+  }
+  int hits = 0;
+  double start = glfwGetTime();
+  for (int i = 0; i < RAYCAST_BENCHMARK_RAYS; i++) {
+    RayHit hit;
+    hits += raycast(s->x, s->y, s->z,
+      directions[i][0], directions[i][1], directions[i][2],
+      HIT_DISTANCE * 2, &hit) > 0;
+  }
+  double elapsed = glfwGetTime() - start;
+  free(directions);
+  g->ray_rate = elapsed > 0 ? RAYCAST_BENCHMARK_RAYS / elapsed : 0;
+  g->ray_hits = hits;
+  printf("Raycast: %d rays in %.1f ms, %.2f M rays/s, %d hits\n",
+    RAYCAST_BENCHMARK_RAYS, elapsed * 1000, g->ray_rate / 1e6, hits);
 }
 
-GLuint gen_text_buffer(float x, float y, float n, char *text) {
-  int length = strlen(text);
-  GLfloat *data = malloc_faces(4, length);
-  for (int i = 0; i < length; i++) {
-    make_character(data + i * 24, x, y, n / 2, n, text[i]);
-    x += n;
+void height_benchmark() {
+  // random columns around the camera, through the cache and by scanning
+  State *s = &g->camera.state;
+  float range = g->render_radius * CHUNK_SIZE * 2;
+  float (*points)[2] = malloc(sizeof(float) * 2 * HEIGHT_BENCHMARK_QUERIES);
+  for (int i = 0; i < HEIGHT_BENCHMARK_QUERIES; i++) {
+    points[i][0] = s->x + random_range(-range, range);
+    points[i][1] = s->z + random_range(-range, range);
+  }
+  int *heights = malloc(sizeof(int) * HEIGHT_BENCHMARK_QUERIES);
+  int scans = HEIGHT_BENCHMARK_QUERIES / HEIGHT_BENCHMARK_SCAN_RATIO;
+  int *scanned_heights = malloc(sizeof(int) * scans);
+  double start = glfwGetTime();
+  for (int i = 0; i < HEIGHT_BENCHMARK_QUERIES; i++) {
+    heights[i] = highest_block(points[i][0], points[i][1]);
   }
-  return gen_faces(4, length, data);
+  double cached = glfwGetTime() - start;
+  start = glfwGetTime();
+  for (int i = 0; i < scans; i++) {
+    scanned_heights[i] = scan_highest_block(points[i][0], points[i][1]);
+  }
+  double scanned = glfwGetTime() - start;
+  // compared once both are timed, so neither rate includes the other
+  int loaded = 0;
+  int mismatches = 0;
+  for (int i = 0; i < HEIGHT_BENCHMARK_QUERIES; i++) {
+    loaded += heights[i] != NO_HEIGHT;
+  }
+  for (int i = 0; i < scans; i++) {
+    mismatches += scanned_heights[i] != heights[i];
+  }
+  free(scanned_heights);
+  free(heights);
+  free(points);
+  g->height_rate = cached > 0 ? HEIGHT_BENCHMARK_QUERIES / cached : 0;
+  g->scan_rate = scanned > 0 ? scans / scanned : 0;
+  printf("Heights: %d queries in %.1f ms, %.2f M/s cached, "
+    "%.3f M/s scanned, %d loaded, %d mismatches\n",
+    HEIGHT_BENCHMARK_QUERIES, cached * 1000, g->height_rate / 1e6,
+    g->scan_rate / 1e6, loaded, mismatches);
 }
 
-void draw_text(Attrib *attrib, GLuint buffer, int length) {
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  draw_triangles_2d(attrib, buffer, length * 6);
-  glDisable(GL_BLEND);
+void player_box(float x, float y, float z, float min[3], float max[3]) {
+  min[0] = x - PLAYER_HALF_WIDTH; max[0] = x + PLAYER_HALF_WIDTH;
+  min[1] = y - PLAYER_BELOW_EYE; max[1] = y + PLAYER_ABOVE_EYE;
+  min[2] = z - PLAYER_HALF_WIDTH; max[2] = z + PLAYER_HALF_WIDTH;
 }
 
-void render_blocks(Attrib *attrib, Camera *camera) {
-  State *s = &camera->state;
-  float matrix[16];
-  set_matrix_3d(
-    matrix, g->width, g->height,
-    s->x, s->y, s->z, s->rx, s->ry, g->fov, g->ortho, g->render_radius);
+void on_left_click() {
+  State *s = &g->camera.state;
+  int hx, hy, hz;
+  if (hit_test(0, s->x, s->y, s->z, s->rx, s->ry, &hx, &hy, &hz)) {
+    set_block(hx, hy, hz, 0);
+  }
+}
 
-  float planes[6][4];
-  frustum_planes(planes, g->render_radius, matrix);
-  glUseProgram(attrib->program);
-  glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
-  glUniform3f(attrib->camera, s->x, s->y, s->z);
-  glUniform1i(attrib->sampler, 0);
-  glUniform1i(attrib->extra1, 2);
-  glUniform1f(attrib->extra2, 0.5); //light
-  glUniform1f(attrib->extra3, g->render_radius * CHUNK_SIZE);
-  glUniform1i(attrib->extra4, g->ortho);
-  glUniform1f(attrib->timer, 0.1); // time of the day function
+void on_right_click() {
+  State *s = &g->camera.state;
+  int hx, hy, hz;
+  if (!hit_test(1, s->x, s->y, s->z, s->rx, s->ry, &hx, &hy, &hz)) {
+    return;
+  }
+  // not into the player
+  float min[3], max[3];
+  player_box(s->x, s->y, s->z, min, max);
+  int cell[3] = {hx, hy, hz};
+  for (int i = 0; i < 3; i++) {
+    if (cell[i] * 2 + 1 <= min[i] || cell[i] * 2 - 1 >= max[i]) {
+      set_block(hx, hy, hz, BUILD_BLOCK);
+      return;
+    }
+  }
+}
+
+void on_mouse_button(GLFWwindow *window, int button, int action, int mods) {
+  int control = mods & (GLFW_MOD_CONTROL | GLFW_MOD_SUPER);
+  int exclusive = glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_DISABLED;
+
+  if (action != GLFW_PRESS) return;
 
-  for (int i = 0; i < g->block_count; i++) {
-    Block block = g->blocks[i];
+  if (button == GLFW_MOUSE_BUTTON_LEFT && exclusive) {
+    if (control) {
+      on_right_click();
+    }
+    else {
+      on_left_click();
+    }
+  }
 
-    GLuint buffer = gen_cube_buffer(block.x, block.y, block.z, 1, block.w);
-    draw_triangles_3d_ao(attrib, buffer, 36);
-    del_buffer(buffer);
+  if (button == GLFW_MOUSE_BUTTON_RIGHT && exclusive) {
+    on_right_click();
   }
 }
 
-void render_text(Attrib *attrib, int justify, float x, float y, float n, char *text) {
-  float matrix[16];
-  set_matrix_2d(matrix, g->width, g->height);
-  glUseProgram(attrib->program);
-  glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
-  glUniform1i(attrib->sampler, 1);
-  glUniform1i(attrib->extra1, 0);
-  int length = strlen(text);
-  x -= n * justify * (length - 1) / 2;
-  GLuint buffer = gen_text_buffer(x, y, n, text);
-  draw_text(attrib, buffer, length);
-  del_buffer(buffer);
+void _load_block(int x, int y, int z, int w, void *arg) {
+  chunk_add_block((Chunk *)arg, x, y, z, w);
 }
 
-void model_setup(){
-  memset(g->blocks, 0, sizeof(Block) * MAX_BLOCKS);
-  g->block_count = 0;
-  memset(g->players, 0, sizeof(Player) * MAX_PLAYERS);
-  g->player_count = 0;
-  g->flying = 1;
-  g->ortho = 0;
-  g->fov = 65;
-  g->render_radius = RENDER_CHUNK_RADIUS;
+void load_chunk(int p, int q, int r) {
+  Chunk *chunk = create_chunk(p, q, r);
+  create_world(p, q, r, _load_block, chunk);
+  EditMap *edits = (EditMap *)map_get(&g->edits, p, q, r);
+  if (edits) {
+    chunk_apply_edits(chunk, edits);
+  }
+  chunk_compact(chunk);
+  column_add(chunk);
+  // neighbours meshed while this chunk was missing treated it as air
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dz = -1; dz <= 1; dz++) {
+        Chunk *other = find_chunk(p + dx, q + dy, r + dz);
+        if (other && other != chunk) {
+          other->dirty = 1;
+        }
+      }
+    }
+  }
 }
 
-void create_block(int x, int y, int z, int w){
-  Block *block = &g->blocks[g->block_count];
+void delete_chunk(Chunk *chunk) {
+  map_remove(&g->chunks, chunk->p, chunk->q, chunk->r);
+  g->chunk_count--;
+  column_remove(chunk);
+  del_chunk_buffer(chunk);
+  del_chunk_query(chunk);
+  chunk_free(chunk);
+  free(chunk);
+}
 
-  block->x = x;
-  block->y = y;
-  block->z = z;
-  block->w = w;
+typedef struct {
+  int p;
+  int q;
+  int r;
+  int distance;
+  Chunk *chunk;
+} ChunkDistance;
+
+int _compare_distance(const void *a, const void *b) {
+  return ((ChunkDistance *)a)->distance - ((ChunkDistance *)b)->distance;
+}
 
-  g->block_count++;
- // block->buffer = gen_cube_buffer(x, y, z, 1, 3);
+void delete_chunks(int cp, int cq, int cr) {
+  // evict chunks beyond the radius, then the farthest ones while over budget
+  int radius = g->render_radius + 1;
+  int count = 0;
+  ChunkDistance *items = malloc(sizeof(ChunkDistance) * g->chunk_count);
+  // edits and column heights stay resident, so they leave less of the
+  // budget for chunks
+  g->chunk_memory = g->edit_memory + g->columns.size * sizeof(Column);
+  MAP_FOR_EACH(&g->chunks, entry) {
+    Chunk *chunk = (Chunk *)entry->value;
+    ChunkDistance *item = items + count++;
+    item->chunk = chunk;
+    item->distance = chunk_distance(
+      chunk->p, chunk->q, chunk->r, cp, cq, cr);
+    g->chunk_memory += chunk_memory(chunk);
+  } END_MAP_FOR_EACH;
+  qsort(items, count, sizeof(ChunkDistance), _compare_distance);
+  int low_water = CHUNK_MEMORY_BUDGET / 10 * 9;
+  int over_budget = g->chunk_memory > CHUNK_MEMORY_BUDGET;
+  for (int i = count - 1; i >= 0; i--) {
+    Chunk *chunk = items[i].chunk;
+    int outside = items[i].distance > radius * radius;
+    if (outside || (over_budget && g->chunk_memory > low_water)) {
+      g->chunk_memory -= chunk_memory(chunk);
+      delete_chunk(chunk);
+    }
+  }
+  free(items);
 }
 
-void delete_all_blocks(){
-  for (int i = 0; i < g->block_count; i++) {
-    Block *block = g->blocks + i;
-    del_buffer(block->buffer);
+void ensure_chunks(Camera *camera) {
+  State *s = &camera->state;
+  int cp = chunked(block_position(s->x));
+  int cq = chunked(block_position(s->y));
+  int cr = chunked(block_position(s->z));
+  int radius = g->render_radius;
+  delete_chunks(cp, cq, cr);
+  if (g->chunk_memory >= CHUNK_MEMORY_BUDGET / 10 * 9) {
+    return;
   }
+  // load the nearest missing chunks first, a few per frame
+  int count = 0;
+  int capacity = 64;
+  ChunkDistance *items = malloc(sizeof(ChunkDistance) * capacity);
+  for (int dp = -radius; dp <= radius; dp++) {
+    for (int dq = -radius; dq <= radius; dq++) {
+      for (int dr = -radius; dr <= radius; dr++) {
+        int distance = dp * dp + dq * dq + dr * dr;
+        if (distance > radius * radius) {
+          continue;
+        }
+        if (find_chunk(cp + dp, cq + dq, cr + dr)) {
+          continue;
+        }
+        if (count == capacity) {
+          capacity *= 2;
+          items = realloc(items, sizeof(ChunkDistance) * capacity);
+        }
+        ChunkDistance *item = items + count++;
+        item->p = cp + dp;
+        item->q = cq + dq;
+        item->r = cr + dr;
+        item->distance = distance;
+      }
+    }
+  }
+  qsort(items, count, sizeof(ChunkDistance), _compare_distance);
+  for (int i = 0; i < count && i < MAX_CHUNK_LOADS; i++) {
+    load_chunk(items[i].p, items[i].q, items[i].r);
+  }
+  free(items);
+}
 
-  g->block_count = 0;
+void delete_all_blocks(){
+  MAP_FOR_EACH(&g->chunks, entry) {
+    Chunk *chunk = (Chunk *)entry->value;
+    del_chunk_buffer(chunk);
+    del_chunk_query(chunk);
+    chunk_free(chunk);
+    free(chunk);
+  } END_MAP_FOR_EACH;
+  map_clear(&g->chunks);
+  MAP_FOR_EACH(&g->columns, entry) {
+    free(entry->value);
+  } END_MAP_FOR_EACH;
+  map_clear(&g->columns);
+  g->chunk_count = 0;
+  g->chunk_memory = 0;
+  MAP_FOR_EACH(&g->edits, entry) {
+    EditMap *edits = (EditMap *)entry->value;
+    edit_map_free(edits);
+    free(edits);
+  } END_MAP_FOR_EACH;
+  map_clear(&g->edits);
+  g->edit_memory = 0;
 }
 
 void set_camera_position(){
@@ -272,27 +2088,27 @@ void set_camera_position(){
 void build_level(){
   for(int i = 0; i < 20; i++){
     for(int j = 0; j < 20; j++){
-      create_block(i, -1, j, 6);
+      set_block(i, -1, j, 6);
     }
   }
 
   for(int i = 0; i < 5; i++){
-    create_block(4, i, 4, i % 4 + 1);
+    set_block(4, i, 4, i % 4 + 1);
   }
 
   for(int i = 0; i < 5; i++){
-    create_block(13, i, 2, 2);
+    set_block(13, i, 2, 2);
   }
 
   for(int i = 0; i < 13; i++){
-    create_block(i, 0, 0, 8);
-    create_block(0, 0, i, 8);
+    set_block(i, 0, 0, 8);
+    set_block(0, 0, i, 8);
   }
 
-  create_block(0, 3, -5, 9);
-  create_block(0, 6, -5, 1);
-  create_block(1, 3, -5, 1);
-  create_block(2, 3, 2, 9);
+  set_block(0, 3, -5, 9);
+  set_block(0, 6, -5, 1);
+  set_block(1, 3, -5, 1);
+  set_block(2, 3, 2, 9);
 }
 
 void get_motion_vector(int flying, int sz, int sx, float rx, float ry, float *vx, float *vy, float *vz) {
@@ -361,8 +2177,88 @@ void handle_mouse_input() {
   }
 }
 
+// small enough not to matter, large enough to survive float rounding
+#define SWEEP_EPSILON 0.0001
+
+int sweep_solid(int axis, int i, int lo[3], int hi[3]) {
+  // any solid block in layer i along axis, within lo to hi on the others
+  int a = (axis + 1) % 3;
+  int b = (axis + 2) % 3;
+  int cell[3];
+  cell[axis] = i;
+  for (cell[a] = lo[a]; cell[a] <= hi[a]; cell[a]++) {
+    for (cell[b] = lo[b]; cell[b] <= hi[b]; cell[b]++) {
+      if (get_block(cell[0], cell[1], cell[2]) > 0) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+float sweep_axis(float min[3], float max[3], int axis, float delta) {
+  // Moves the box along one axis and stops it at the first solid layer of
+  // blocks in its way. Only the layers between where its leading face is
+  // and where it would end up are looked at, however fast it moves.
+  // Works in block space, where block i spans [i, i + 1).
+  if (delta == 0) {
+    return 0;
+  }
+  int lo[3], hi[3];
+  for (int i = 0; i < 3; i++) {
+    lo[i] = floorf((min[i] + 1) / 2 + SWEEP_EPSILON);
+    hi[i] = floorf((max[i] + 1) / 2 - SWEEP_EPSILON);
+  }
+  float move = delta / 2;
+  if (move > 0) {
+    float face = (max[axis] + 1) / 2;
+    int end = floorf(face + move - SWEEP_EPSILON);
+    for (int i = floorf(face - SWEEP_EPSILON) + 1; i <= end; i++) {
+      if (sweep_solid(axis, i, lo, hi)) {
+        move = i - face;
+        break;
+      }
+    }
+  }
+  else {
+    float face = (min[axis] + 1) / 2;
+    int end = floorf(face + move + SWEEP_EPSILON);
+    for (int i = floorf(face + SWEEP_EPSILON) - 1; i >= end; i--) {
+      if (sweep_solid(axis, i, lo, hi)) {
+        move = i + 1 - face;
+        break;
+      }
+    }
+  }
+  min[axis] += move * 2;
+  max[axis] += move * 2;
+  return move * 2;
+}
+
+int collide(float *x, float *y, float *z, float motion[3]) {
+  // Resolves the motion one axis at a time, vertical first so landing
+  // is settled before sliding along walls. Returns the blocked axes as
+  // bits 1 << axis.
+  float min[3], max[3];
+  float *position[3] = {x, y, z};
+  static const int order[3] = {1, 0, 2};
+  int blocked = 0;
+  player_box(*x, *y, *z, min, max);
+  for (int i = 0; i < 3; i++) {
+    int axis = order[i];
+    float moved = sweep_axis(min, max, axis, motion[axis]);
+    *position[axis] += moved;
+    if (moved != motion[axis]) {
+      blocked |= 1 << axis;
+    }
+  }
+  return blocked;
+}
+
 void handle_movement(double dt) {
   static float dy = 0;
+  // landed at the end of the last move, so a jump can start
+  static int on_ground = 0;
   Camera *camera = &g->camera;
   State *s = &camera->state;
 
@@ -385,41 +2281,37 @@ void handle_movement(double dt) {
   if (glfwGetKey(g->window, CUBE_KEY_JUMP)) {
     if (g->flying) {
       vy = 1;
-    } else if (dy == 0) {
+    } else if (on_ground) {
       dy = 8;
     }
   }
 
   float speed = g->flying ? 20 : 5;
-  int estimate = roundf(sqrtf(
-      powf(vx * speed, 2) +
-      powf(vy * speed + ABS(dy) * 2, 2) +
-      powf(vz * speed, 2)) * dt * 8);
-  int step = MAX(8, estimate);
-  float ut = dt / step;
-  vx = vx * ut * speed;
-  vy = vy * ut * speed;
-  vz = vz * ut * speed;
-  for (int i = 0; i < step; i++) {
-    if (g->flying) {
-      dy = 0;
-    }
-    else {
-      dy -= ut * 25;
-      dy = MAX(dy, -250);
-    }
-    s->x += vx;
-    s->y += vy + dy * ut;
-    s->z += vz;
-    // if (collide(2, &s->x, &s->y, &s->z)) {
-    //   dy = 0;
-    // }
+  if (g->flying) {
+    dy = 0;
+  }
+  else {
+    dy -= dt * 25;
+    dy = MAX(dy, -250);
+  }
+  // the sweep cannot tunnel, so the whole frame is one move
+  float motion[3] = {
+    vx * speed * dt,
+    vy * speed * dt + dy * dt,
+    vz * speed * dt
+  };
+  int falling = motion[1] < 0;
+  int blocked = collide(&s->x, &s->y, &s->z, motion) & 2;
+  // a ceiling only stops the rise; landing is what allows another jump
+  on_ground = blocked && falling;
+  if (blocked) {
+    dy = falling ? 0 : MIN(dy, 0);
   }
-  //if (s->y < 0) {
-   //s->y = highest_block(s->x, s->z) + 2;
- // }
-  if(s -> y < 0) {
-    s->y = 0;
+  if (s->y < FALL_LIMIT) {
+    // fell out of the world; stand on the column's top block if loaded
+    int y = highest_block(s->x, s->z);
+    s->y = y == NO_HEIGHT ? 0 : y * 2 + 1 + PLAYER_BELOW_EYE;
+    dy = 0;
   }
 }
 
@@ -456,10 +2348,26 @@ int main(void){
   GLuint texture;
   glGenTextures(1, &texture);
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  load_png_texture("textures/texture.png");
+  int texture_array = USE_TEXTURE_ARRAY && has_texture_arrays();
+  int texture_layers = 0;
+  if (texture_array) {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+      GL_NEAREST_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    texture_layers =
+      load_png_texture_array("textures/texture.png", 16, 16);
+  }
+  else {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    load_png_texture("textures/texture.png");
+  }
+  const char *block_fragment = texture_array ?
+    "shaders/block_array_fragment.glsl" : "shaders/block_fragment.glsl";
 
   GLuint font;
   glGenTextures(1, &font);
@@ -471,10 +2379,13 @@ int main(void){
 
   // SHADERS
   Attrib block_attrib = {0};
+  Attrib packed_attrib = {0};
+  Attrib entity_attrib = {0};
+  Attrib query_attrib = {0};
   Attrib text_attrib = {0};
   GLuint program;
 
-  program = load_program("shaders/block_vertex.glsl", "shaders/block_fragment.glsl");
+  program = load_program("shaders/block_vertex.glsl", block_fragment);
   block_attrib.program = program;
   block_attrib.position = glGetAttribLocation(program, "position");
   block_attrib.normal = glGetAttribLocation(program, "normal");
@@ -488,6 +2399,43 @@ int main(void){
   block_attrib.camera = glGetUniformLocation(program, "camera");
   block_attrib.timer = glGetUniformLocation(program, "timer");
 
+  program = load_program("shaders/block_packed_vertex.glsl", block_fragment);
+  packed_attrib.program = program;
+  packed_attrib.position = glGetAttribLocation(program, "position");
+  packed_attrib.uv = glGetAttribLocation(program, "uv");
+  packed_attrib.matrix = glGetUniformLocation(program, "matrix");
+  packed_attrib.sampler = glGetUniformLocation(program, "sampler");
+  packed_attrib.extra1 = glGetUniformLocation(program, "sky_sampler");
+  packed_attrib.extra2 = glGetUniformLocation(program, "daylight");
+  packed_attrib.extra3 = glGetUniformLocation(program, "fog_distance");
+  packed_attrib.extra4 = glGetUniformLocation(program, "ortho");
+  packed_attrib.extra5 = glGetUniformLocation(program, "origin");
+  packed_attrib.camera = glGetUniformLocation(program, "camera");
+  packed_attrib.timer = glGetUniformLocation(program, "timer");
+
+  program = load_program("shaders/entity_vertex.glsl", block_fragment);
+  entity_attrib.program = program;
+  entity_attrib.position = glGetAttribLocation(program, "position");
+  entity_attrib.normal = glGetAttribLocation(program, "normal");
+  entity_attrib.uv = glGetAttribLocation(program, "uv");
+  entity_attrib.instance = glGetAttribLocation(program, "instance");
+  entity_attrib.orientation = glGetAttribLocation(program, "orientation");
+  entity_attrib.matrix = glGetUniformLocation(program, "matrix");
+  entity_attrib.sampler = glGetUniformLocation(program, "sampler");
+  entity_attrib.extra1 = glGetUniformLocation(program, "sky_sampler");
+  entity_attrib.extra2 = glGetUniformLocation(program, "daylight");
+  entity_attrib.extra3 = glGetUniformLocation(program, "fog_distance");
+  entity_attrib.extra4 = glGetUniformLocation(program, "ortho");
+  entity_attrib.camera = glGetUniformLocation(program, "camera");
+  entity_attrib.timer = glGetUniformLocation(program, "timer");
+
+  program = load_program("shaders/query_vertex.glsl", "shaders/query_fragment.glsl");
+  query_attrib.program = program;
+  query_attrib.position = glGetAttribLocation(program, "position");
+  query_attrib.matrix = glGetUniformLocation(program, "matrix");
+  query_attrib.extra1 = glGetUniformLocation(program, "origin");
+  query_attrib.extra2 = glGetUniformLocation(program, "size");
+
   program = load_program("shaders/text_vertex.glsl", "shaders/text_fragment.glsl");
   text_attrib.program = program;
   text_attrib.position = glGetAttribLocation(program, "position");
@@ -497,7 +2445,9 @@ int main(void){
   text_attrib.extra1 = glGetUniformLocation(program, "is_sign");
 
   model_setup();
+  g->quad_buffer = gen_quad_buffer(MESH_MAX_FACES);
   build_level();
+  worker_pool_init(&g->workers, MAX(1, cpu_count() - 1));
 
   FPS fps = {0, 0, 0};
 
@@ -516,32 +2466,224 @@ int main(void){
     update_fps(&fps);
     double now = glfwGetTime();
     double dt = now - previous;
+    frame_histogram_add(&g->frames, dt);
     dt = MIN(dt, 0.2);
     dt = MAX(dt, 0.0);
     previous = now;
 
     handle_mouse_input();
     handle_movement(dt);
+    update_entities(dt);
+    if (g->raycast_benchmark) {
+      raycast_benchmark();
+      g->raycast_benchmark = 0;
+    }
+    if (g->height_benchmark) {
+      height_benchmark();
+      g->height_benchmark = 0;
+    }
+    ensure_chunks(camera);
+    update_chunks();
 
     // RENDERING
     glClearColor(135.0f / 255.0f, 206.0f / 255.0f, 250.0f / 255.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     glClear(GL_DEPTH_BUFFER_BIT);
 
-    render_blocks(&block_attrib, camera);
+    double draw_start = glfwGetTime();
+    render_blocks(&block_attrib, &packed_attrib, camera);
+    frame_histogram_add(&g->draw_times, glfwGetTime() - draw_start);
+
+    double entity_start = glfwGetTime();
+    render_entities(&entity_attrib, camera);
+    if (g->player_count + g->entity_count) {
+      frame_histogram_add(&g->entity_times, glfwGetTime() - entity_start);
+    }
+    render_queries(&query_attrib);
 
     // RENDER TEXT
     char text_buffer[1024];
     float ts = 12 * g->scale;
     float tx = ts / 2;
     float ty = g->height - ts;
+    double text_start = glfwGetTime();
+    int text_glyphs = g->text_glyphs;
     if (SHOW_INFO_TEXT) {
+      begin_text();
       snprintf(text_buffer, 1024,
         "Position: %.2f, %.2f, %.2f, Rotation: (%.2f, %.2f), FPS: %d",
         s->x, s->y, s->z, s->rx, s->ry, fps.fps);
 
-      render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      RayHit target;
+      float vx, vy, vz;
+      get_sight_vector(s->rx, s->ry, &vx, &vy, &vz);
+      int length = raycast(
+        s->x, s->y, s->z, vx, vy, vz, HIT_DISTANCE * 2, &target) ?
+        snprintf(text_buffer, 1024,
+          "Target: block %d at %d, %d, %d, face %d, %.1f away",
+          target.w, target.x, target.y, target.z, target.face,
+          target.distance) :
+        snprintf(text_buffer, 1024, "Target: none within %d blocks",
+          HIT_DISTANCE);
+      if (g->ray_rate) {
+        snprintf(text_buffer + length, 1024 - length,
+          ", Raycast: %.2f M rays/s", g->ray_rate / 1e6);
+      }
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      int ground = highest_block(s->x, s->z);
+      length = ground == NO_HEIGHT ?
+        snprintf(text_buffer, 1024, "Ground: not loaded, Columns: %d",
+          g->columns.size) :
+        snprintf(text_buffer, 1024, "Ground: block %d, Columns: %d",
+          ground, g->columns.size);
+      if (g->height_rate) {
+        snprintf(text_buffer + length, 1024 - length,
+          ", Heights: %.1f M/s cached, %.2f M/s scanned",
+          g->height_rate / 1e6, g->scan_rate / 1e6);
+      }
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      snprintf(text_buffer, 1024,
+        "Chunks: %d, Faces: %d, Skipped: %d, Vertices: %d, Mesher: %s",
+        g->chunk_count, g->face_count, g->skipped_count,
+        g->vertex_count, g->greedy ? "greedy" : "culled");
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      snprintf(text_buffer, 1024,
+        "Frustum: %d tested, %d culled, %d occluded, %d drawn",
+        g->tested_count, g->culled_count, g->occluded_count,
+        g->drawn_count);
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      if (g->queries) {
+        snprintf(text_buffer, 1024,
+          "Queries: %s, %d hidden, %d conditional",
+          occlusion_query_target() == GL_ANY_SAMPLES_PASSED ?
+            "any samples" : "samples passed",
+          g->query_hidden_count, g->conditional_count);
+        add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+        ty -= ts * 2;
+      }
+
+      if (g->occlusion) {
+        snprintf(text_buffer, 1024,
+          "Occlusion: %dx%d CPU depth, %d chunks, %d faces, "
+          "mean %.2f ms",
+          OCCLUSION_WIDTH, OCCLUSION_HEIGHT, g->occluder_count,
+          g->occlusion_buffer.faces,
+          g->occlusion_times.count ?
+            g->occlusion_times.total / g->occlusion_times.count * 1000 :
+            0.0);
+        add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+        ty -= ts * 2;
+      }
+
+      snprintf(text_buffer, 1024,
+        "Resident: %d chunks, %.1f / %d MB, Edits: %.1f MB, "
+        "Blocks: %d uniform, %.3f bytes each",
+        g->chunk_count, g->chunk_memory / 1048576.0,
+        CHUNK_MEMORY_BUDGET / 1048576, g->edit_memory / 1048576.0,
+        g->uniform_count,
+        g->chunk_count ?
+          (double)g->block_bytes / g->chunk_count / CHUNK_VOLUME : 0.0);
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      snprintf(text_buffer, 1024,
+        "Frame: p50 %.1f ms, p99 %.1f ms, max %.1f ms, "
+        "Meshing: %s (%d workers, %d jobs)",
+        frame_histogram_percentile(&g->frames, 50) * 1000,
+        frame_histogram_percentile(&g->frames, 99) * 1000,
+        g->frames.worst * 1000,
+        g->threaded ? "threaded" : "inline",
+        g->workers.count, g->jobs_in_flight);
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      snprintf(text_buffer, 1024,
+        "Draw CPU: mean %.2f ms, p99 %.1f ms, Vertex arrays: %s, "
+        "Draw calls: %d (%s)",
+        g->draw_times.count ?
+          g->draw_times.total / g->draw_times.count * 1000 : 0.0,
+        frame_histogram_percentile(&g->draw_times, 99) * 1000,
+        g->vertex_arrays ? "on" :
+          has_vertex_arrays() ? "off" : "unsupported",
+        g->draw_calls, g->batched ? "batched" : "per chunk");
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      for (int i = 0; i < 2; i++) {
+        ArenaStats stats;
+        arena_stats(g->arenas + i, &stats);
+        if (!stats.slabs) {
+          continue;
+        }
+        snprintf(text_buffer, 1024,
+          "Arena (%s): %d slabs, %.1f / %.1f MB, %d holes, "
+          "%.0f%% fragmented, %.1f MB moved",
+          i ? "packed" : "float", stats.slabs,
+          stats.used / 1048576.0, stats.capacity / 1048576.0, stats.holes,
+          stats.fragmentation * 100, g->arenas[i].moved / 1048576.0);
+        add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+        ty -= ts * 2;
+      }
+
+      snprintf(text_buffer, 1024,
+        "Uploads: %d chunks, %.1f KB this frame, %d waiting",
+        g->upload_count, g->upload_bytes / 1024.0, g->ready_count);
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      snprintf(text_buffer, 1024,
+        "Vertices: %s %s, %d bytes each, %.1f MB, "
+        "uploaded %.1f MB in %.1f ms",
+        g->packed ? "packed" : "float", g->indexed ? "quads" : "triangles",
+        mesh_vertex_size(mesh_flags()),
+        g->vertex_bytes / 1048576.0, g->upload_total_bytes / 1048576.0,
+        g->upload_total_time * 1000);
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      if (texture_array) {
+        snprintf(text_buffer, 1024,
+          "Textures: array, %d mipmapped layers", texture_layers);
+      }
+      else {
+        snprintf(text_buffer, 1024, "Textures: %s",
+          USE_TEXTURE_ARRAY ? "atlas (arrays unsupported)" : "atlas");
+      }
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
       ty -= ts * 2;
+
+      snprintf(text_buffer, 1024,
+        "Entities: %d players, %d cubes, %d draws (%s), CPU mean %.3f ms",
+        g->player_count, g->entity_count, g->entity_draws,
+        g->instanced ? "instanced" :
+          has_instancing() ? "per entity" : "instancing unsupported",
+        g->entity_times.count ?
+          g->entity_times.total / g->entity_times.count * 1000 : 0.0);
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+
+      snprintf(text_buffer, 1024,
+        "Text: %s, %d strings in 1 draw, %d glyphs rebuilt, "
+        "CPU mean %.3f ms",
+        g->text_cache ? "cached" : "rebuilt every frame",
+        g->text_strings + 1, text_glyphs,
+        g->text_times.count ?
+          g->text_times.total / g->text_times.count * 1000 : 0.0);
+      add_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+      flush_text(&text_attrib);
+      frame_histogram_add(&g->text_times, glfwGetTime() - text_start);
     }
 
     glfwSwapBuffers(g->window);
@@ -556,7 +2698,61 @@ int main(void){
     }
   }
 
+  frame_histogram_print(
+    &g->frames, g->threaded ? "Frame times (workers)" : "Frame times");
+  frame_histogram_print(&g->draw_times, g->vertex_arrays ?
+    "Chunk draw CPU (vertex arrays)" : "Chunk draw CPU (attribute setup)");
+  frame_histogram_print(&g->text_times, g->text_cache ?
+    "Overlay CPU (cached)" : "Overlay CPU (rebuilt)");
+  if (g->occlusion) {
+    frame_histogram_print(&g->occlusion_times, "Occlusion CPU");
+  }
+  frame_histogram_print(&g->entity_times, g->instanced ?
+    "Entity draw CPU (instanced)" : "Entity draw CPU (per entity)");
+  worker_pool_free(&g->workers);
+  for (int i = 0; i < g->ready_count; i++) {
+    free(g->ready[i]->mesh.data);
+    free(g->ready[i]);
+  }
+  free(g->ready);
   delete_all_blocks();
+  del_buffer(g->quad_buffer);
+  for (int i = 0; i < 2; i++) {
+    arena_free(g->arenas + i);
+  }
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < ARENA_SLABS; j++) {
+      DrawList *list = g->batches[i] + j;
+      free(list->first);
+      free(list->count);
+      free(list->indices);
+      free(list->chunks);
+    }
+  }
+  if (g->entity_buffer) {
+    del_buffer(g->entity_buffer);
+  }
+  if (g->instance_buffer) {
+    del_buffer(g->instance_buffer);
+  }
+  free(g->entities);
+  free(g->instance_data);
+  occlusion_free(&g->occlusion_buffer);
+  free(g->occluders);
+  free(g->query_chunks);
+  if (g->query_buffer) {
+    del_buffer(g->query_buffer);
+  }
+  if (g->text_vao) {
+    del_vertex_array(g->text_vao);
+  }
+  if (g->text_buffer) {
+    del_buffer(g->text_buffer);
+  }
+  free(g->text_data);
+  map_free(&g->chunks);
+  map_free(&g->edits);
+  map_free(&g->columns);
 
   glfwTerminate();
   return 0;
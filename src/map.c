@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include "map.h"
+
+static unsigned int hash_int(unsigned int key) {
+    key = ~key + (key << 15);
+    key = key ^ (key >> 12);
+    key = key + (key << 2);
+    key = key ^ (key >> 4);
+    key = key * 2057;
+    key = key ^ (key >> 16);
+    return key;
+}
+
+static unsigned int hash(int p, int q, int r) {
+    unsigned int key =
+        (unsigned int)p * 73856093u ^
+        (unsigned int)q * 19349663u ^
+        (unsigned int)r * 83492791u;
+    return hash_int(key);
+}
+
+static void map_grow(Map *map) {
+    Map new_map;
+    map_alloc(&new_map, (map->mask << 1) | 1);
+    for (unsigned int i = 0; i <= map->mask; i++) {
+        MapEntry *entry = map->data + i;
+        if (entry->value) {
+            map_set(&new_map, entry->p, entry->q, entry->r, entry->value);
+        }
+    }
+    free(map->data);
+    map->mask = new_map.mask;
+    map->size = new_map.size;
+    map->data = new_map.data;
+}
+
+void map_alloc(Map *map, int mask) {
+    map->mask = mask;
+    map->size = 0;
+    map->data = (MapEntry *)calloc(map->mask + 1, sizeof(MapEntry));
+}
+
+void map_free(Map *map) {
+    free(map->data);
+    map->data = NULL;
+    map->mask = 0;
+    map->size = 0;
+}
+
+void map_clear(Map *map) {
+    memset(map->data, 0, sizeof(MapEntry) * (map->mask + 1));
+    map->size = 0;
+}
+
+void *map_get(Map *map, int p, int q, int r) {
+    unsigned int index = hash(p, q, r) & map->mask;
+    MapEntry *entry = map->data + index;
+    while (entry->value) {
+        if (entry->p == p && entry->q == q && entry->r == r) {
+            return entry->value;
+        }
+        index = (index + 1) & map->mask;
+        entry = map->data + index;
+    }
+    return NULL;
+}
+
+void map_set(Map *map, int p, int q, int r, void *value) {
+    unsigned int index = hash(p, q, r) & map->mask;
+    MapEntry *entry = map->data + index;
+    while (entry->value) {
+        if (entry->p == p && entry->q == q && entry->r == r) {
+            entry->value = value;
+            return;
+        }
+        index = (index + 1) & map->mask;
+        entry = map->data + index;
+    }
+    entry->p = p;
+    entry->q = q;
+    entry->r = r;
+    entry->value = value;
+    map->size++;
+    if (map->size * 2 > map->mask) {
+        map_grow(map);
+    }
+}
+
+void *map_remove(Map *map, int p, int q, int r) {
+    unsigned int index = hash(p, q, r) & map->mask;
+    MapEntry *entry = map->data + index;
+    while (entry->value) {
+        if (entry->p == p && entry->q == q && entry->r == r) {
+            break;
+        }
+        index = (index + 1) & map->mask;
+        entry = map->data + index;
+    }
+    if (!entry->value) {
+        return NULL;
+    }
+    void *value = entry->value;
+    entry->value = NULL;
+    map->size--;
+    // backward shift deletion keeps probe sequences intact without tombstones
+    unsigned int hole = index;
+    index = (index + 1) & map->mask;
+    entry = map->data + index;
+    while (entry->value) {
+        unsigned int home = hash(entry->p, entry->q, entry->r) & map->mask;
+        if (((index - home) & map->mask) >= ((index - hole) & map->mask)) {
+            map->data[hole] = *entry;
+            entry->value = NULL;
+            hole = index;
+        }
+        index = (index + 1) & map->mask;
+        entry = map->data + index;
+    }
+    return value;
+}
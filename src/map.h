@@ -0,0 +1,33 @@
+#ifndef _map_h_
+#define _map_h_
+
+typedef struct {
+    int p;
+    int q;
+    int r;
+    void *value;
+} MapEntry;
+
+typedef struct {
+    unsigned int mask;
+    unsigned int size;
+    MapEntry *data;
+} Map;
+
+#define MAP_FOR_EACH(map, entry) \
+    for (unsigned int i = 0; i <= (map)->mask; i++) { \
+        MapEntry *entry = (map)->data + i; \
+        if (!entry->value) { \
+            continue; \
+        }
+
+#define END_MAP_FOR_EACH }
+
+void map_alloc(Map *map, int mask);
+void map_free(Map *map);
+void map_clear(Map *map);
+void *map_get(Map *map, int p, int q, int r);
+void map_set(Map *map, int p, int q, int r, void *value);
+void *map_remove(Map *map, int p, int q, int r);
+
+#endif
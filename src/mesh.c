@@ -0,0 +1,411 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cube.h"
+#include "item.h"
+#include "mesh.h"
+#include "util.h"
+
+// neighbours of a block are numbered (dx + 1) * 9 + (dy + 1) * 3 + (dz + 1)
+static const int lookup3[6][4][3] = {
+    {{0, 1, 3}, {2, 1, 5}, {6, 7, 3}, {8, 7, 5}},
+    {{18, 19, 21}, {20, 19, 23}, {24, 25, 21}, {26, 25, 23}},
+    {{6, 7, 15}, {8, 7, 17}, {24, 25, 15}, {26, 25, 17}},
+    {{0, 1, 9}, {2, 1, 11}, {18, 19, 9}, {20, 19, 11}},
+    {{0, 3, 9}, {6, 3, 15}, {18, 21, 9}, {24, 21, 15}},
+    {{2, 5, 11}, {8, 5, 17}, {20, 23, 11}, {26, 23, 17}}
+};
+
+static const int lookup4[6][4][4] = {
+    {{0, 1, 3, 4}, {1, 2, 4, 5}, {3, 4, 6, 7}, {4, 5, 7, 8}},
+    {{18, 19, 21, 22}, {19, 20, 22, 23}, {21, 22, 24, 25}, {22, 23, 25, 26}},
+    {{6, 7, 15, 16}, {7, 8, 16, 17}, {15, 16, 24, 25}, {16, 17, 25, 26}},
+    {{0, 1, 9, 10}, {1, 2, 10, 11}, {9, 10, 18, 19}, {10, 11, 19, 20}},
+    {{0, 3, 9, 12}, {3, 6, 12, 15}, {9, 12, 18, 21}, {12, 15, 21, 24}},
+    {{2, 5, 11, 14}, {5, 8, 14, 17}, {11, 14, 20, 23}, {14, 17, 23, 26}}
+};
+
+typedef struct {
+    const unsigned char *padded;
+    // per cell, how strongly blocks overhead shade it, in eighths
+    unsigned char shade[PADDED_SIZE * PADDED_SIZE * PADDED_SIZE];
+    int offsets[27];
+} Occlusion;
+
+static void occlusion_init(Occlusion *o, const unsigned char *padded) {
+    o->padded = padded;
+    int index = 0;
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dz = -1; dz <= 1; dz++) {
+                o->offsets[index++] = PADDED_INDEX(dx, dy, dz);
+            }
+        }
+    }
+    for (int z = 0; z < PADDED_SIZE; z++) {
+        for (int x = 0; x < PADDED_SIZE; x++) {
+            int last = PADDED_HEIGHT + SHADE_HEIGHT;
+            for (int y = PADDED_HEIGHT - 1; y >= 0; y--) {
+                if (padded[PADDED_INDEX(x, y, z)]) {
+                    last = y;
+                }
+                if (y < PADDED_SIZE) {
+                    int distance = last - y;
+                    o->shade[PADDED_INDEX(x, y, z)] =
+                        distance < SHADE_HEIGHT ? SHADE_HEIGHT - distance : 0;
+                }
+            }
+        }
+    }
+}
+
+// Packs each corner of the face as the number of occluding neighbours
+// (0 - 3) in the low two bits and the summed shade of the four cells
+// touching the corner above that.
+static void face_corners(
+    Occlusion *o, int x, int y, int z, int face, int corners[4])
+{
+    int base = PADDED_INDEX(x, y, z);
+    const unsigned char *padded = o->padded + base;
+    const unsigned char *shade = o->shade + base;
+    for (int j = 0; j < 4; j++) {
+        int corner = padded[o->offsets[lookup3[face][j][0]]] != 0;
+        int side1 = padded[o->offsets[lookup3[face][j][1]]] != 0;
+        int side2 = padded[o->offsets[lookup3[face][j][2]]] != 0;
+        int value = side1 && side2 ? 3 : corner + side1 + side2;
+        int total = 0;
+        for (int k = 0; k < 4; k++) {
+            total += shade[o->offsets[lookup4[face][j][k]]];
+        }
+        corners[j] = value | (total << 2);
+    }
+}
+
+static void corner_values(int corners[4], float ao[4], float light[4]) {
+    static const int full = SHADE_HEIGHT * 4;
+    for (int j = 0; j < 4; j++) {
+        int value = corners[j] & 3;
+        int total = corners[j] >> 2;
+        // each occluder darkens by a quarter, like the shade of one cell
+        ao[j] = MIN(value * SHADE_HEIGHT + total, full) / (float)full;
+        light[j] = 0.5 * (full - total) / full;
+    }
+}
+
+static int exposed_faces(const unsigned char *padded, int x, int y, int z, int faces[6]) {
+    faces[0] = !padded[PADDED_INDEX(x - 1, y, z)];
+    faces[1] = !padded[PADDED_INDEX(x + 1, y, z)];
+    faces[2] = !padded[PADDED_INDEX(x, y + 1, z)];
+    faces[3] = !padded[PADDED_INDEX(x, y - 1, z)];
+    faces[4] = !padded[PADDED_INDEX(x, y, z - 1)];
+    faces[5] = !padded[PADDED_INDEX(x, y, z + 1)];
+    return faces[0] + faces[1] + faces[2] + faces[3] + faces[4] + faces[5];
+}
+
+int mesh_vertex_size(int flags) {
+    return flags & MESH_PACKED ? PACKED_VERTEX_SIZE : FLOAT_VERTEX_SIZE;
+}
+
+int mesh_face_vertices(int flags) {
+    return flags & MESH_INDEXED ? 4 : 6;
+}
+
+// Writes face number index of the mesh. local is the chunk-local block at
+// the minimum corner of the face and size its extent in blocks.
+static void emit_face(
+    Mesh *mesh, int index, float ao[4], float light[4], int face, int tile,
+    const int origin[3], const int local[3], const int size[3])
+{
+    int indexed = mesh->flags & MESH_INDEXED;
+    int offset = index * mesh_face_vertices(mesh->flags) *
+        mesh_vertex_size(mesh->flags);
+    if (mesh->flags & MESH_PACKED) {
+        unsigned char *d = (unsigned char *)mesh->data + offset;
+        make_face_packed(
+            d, ao, light, face, tile, local[0], local[1], local[2],
+            size[0], size[1], size[2], indexed);
+    }
+    else {
+        GLfloat *d = (GLfloat *)((char *)mesh->data + offset);
+        make_face(
+            d, ao, light, face, tile,
+            (origin[0] + local[0]) * 2, (origin[1] + local[1]) * 2,
+            (origin[2] + local[2]) * 2, 1, size[0], size[1], size[2],
+            indexed);
+    }
+}
+
+static void mesh_culled(Mesh *mesh, Occlusion *o, int ox, int oy, int oz) {
+    static const int unit[3] = {1, 1, 1};
+    const unsigned char *padded = o->padded;
+    float ao[4];
+    float light[4];
+    int faces[6];
+    int corners[4];
+    int origin[3] = {ox, oy, oz};
+    int index = 0;
+    for (int y = 1; y <= CHUNK_SIZE; y++) {
+        for (int z = 1; z <= CHUNK_SIZE; z++) {
+            for (int x = 1; x <= CHUNK_SIZE; x++) {
+                int w = padded[PADDED_INDEX(x, y, z)];
+                if (!w) {
+                    continue;
+                }
+                if (!exposed_faces(padded, x, y, z, faces)) {
+                    continue;
+                }
+                int local[3] = {x - 1, y - 1, z - 1};
+                for (int i = 0; i < 6; i++) {
+                    if (!faces[i]) {
+                        continue;
+                    }
+                    face_corners(o, x, y, z, i, corners);
+                    corner_values(corners, ao, light);
+                    emit_face(
+                        mesh, index++, ao, light, i, blocks[w][i],
+                        origin, local, unit);
+                }
+            }
+        }
+    }
+}
+
+static void mesh_greedy(Mesh *mesh, Occlusion *o, int ox, int oy, int oz) {
+    // normal axis followed by the two axes spanning the face, per face
+    static const int axes[6][3] = {
+        {0, 1, 2}, {0, 1, 2}, {1, 0, 2}, {1, 0, 2}, {2, 0, 1}, {2, 0, 1}
+    };
+    static const int directions[6] = {-1, +1, +1, -1, -1, +1};
+    const unsigned char *padded = o->padded;
+    float ao[4];
+    float light[4];
+    int corners[4];
+    // 0 marks no face, otherwise tile + 1 with the packed corners above it,
+    // so only faces that would shade identically are merged
+    uint64_t mask[CHUNK_SIZE * CHUNK_SIZE];
+    int origin[3] = {ox, oy, oz};
+    int faces = 0;
+    for (int i = 0; i < 6; i++) {
+        int n = axes[i][0];
+        int a = axes[i][1];
+        int b = axes[i][2];
+        for (int slice = 1; slice <= CHUNK_SIZE; slice++) {
+            int pos[3];
+            int other[3];
+            pos[n] = slice;
+            other[n] = slice + directions[i];
+            for (int v = 0; v < CHUNK_SIZE; v++) {
+                pos[b] = other[b] = v + 1;
+                for (int u = 0; u < CHUNK_SIZE; u++) {
+                    pos[a] = other[a] = u + 1;
+                    uint64_t key = 0;
+                    int w = padded[PADDED_INDEX(pos[0], pos[1], pos[2])];
+                    if (w && !padded[PADDED_INDEX(other[0], other[1], other[2])]) {
+                        face_corners(o, pos[0], pos[1], pos[2], i, corners);
+                        key = blocks[w][i] + 1;
+                        for (int j = 0; j < 4; j++) {
+                            key |= (uint64_t)corners[j] << (8 + j * 8);
+                        }
+                    }
+                    mask[v * CHUNK_SIZE + u] = key;
+                }
+            }
+            for (int v = 0; v < CHUNK_SIZE; v++) {
+                for (int u = 0; u < CHUNK_SIZE; ) {
+                    uint64_t key = mask[v * CHUNK_SIZE + u];
+                    if (!key) {
+                        u++;
+                        continue;
+                    }
+                    int width = 1;
+                    while (u + width < CHUNK_SIZE &&
+                        mask[v * CHUNK_SIZE + u + width] == key)
+                    {
+                        width++;
+                    }
+                    int height = 1;
+                    for (; v + height < CHUNK_SIZE; height++) {
+                        uint64_t *row = mask + (v + height) * CHUNK_SIZE + u;
+                        int k = 0;
+                        while (k < width && row[k] == key) {
+                            k++;
+                        }
+                        if (k < width) {
+                            break;
+                        }
+                    }
+                    for (int dv = 0; dv < height; dv++) {
+                        memset(mask + (v + dv) * CHUNK_SIZE + u, 0,
+                            sizeof(uint64_t) * width);
+                    }
+                    for (int j = 0; j < 4; j++) {
+                        corners[j] = (key >> (8 + j * 8)) & 0xff;
+                    }
+                    corner_values(corners, ao, light);
+                    int size[3];
+                    int local[3];
+                    size[n] = 1;
+                    size[a] = width;
+                    size[b] = height;
+                    local[n] = slice - 1;
+                    local[a] = u;
+                    local[b] = v;
+                    emit_face(
+                        mesh, faces++, ao, light, i, (key & 0xff) - 1,
+                        origin, local, size);
+                    u += width;
+                }
+            }
+        }
+    }
+    mesh->faces = faces;
+}
+
+static int occluder_volume(const Occluder *occluder) {
+    return
+        (occluder->max[0] - occluder->min[0]) *
+        (occluder->max[1] - occluder->min[1]) *
+        (occluder->max[2] - occluder->min[2]);
+}
+
+#define CHUNK_INDEX(x, y, z) \
+    (((y) * CHUNK_SIZE + (z)) * CHUNK_SIZE + (x))
+
+// solid and not yet part of an occluder box
+static int occluder_solid(
+    const unsigned char *padded, const unsigned char *used,
+    int x, int y, int z)
+{
+    return
+        padded[PADDED_INDEX(x + 1, y + 1, z + 1)] &&
+        !used[CHUNK_INDEX(x, y, z)];
+}
+
+// Splits the chunk's blocks into solid boxes, growing each along x, then
+// z, then y, and keeps the largest as occluders.
+static void mesh_occluders(
+    Mesh *mesh, const unsigned char *padded, int ox, int oy, int oz)
+{
+    unsigned char *used = calloc(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE, 1);
+    mesh->occluder_count = 0;
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                if (!occluder_solid(padded, used, x, y, z)) {
+                    continue;
+                }
+                int x1 = x + 1;
+                while (x1 < CHUNK_SIZE &&
+                    occluder_solid(padded, used, x1, y, z))
+                {
+                    x1++;
+                }
+                int z1 = z + 1;
+                for (; z1 < CHUNK_SIZE; z1++) {
+                    int i = x;
+                    while (i < x1 && occluder_solid(padded, used, i, y, z1)) {
+                        i++;
+                    }
+                    if (i < x1) {
+                        break;
+                    }
+                }
+                int y1 = y + 1;
+                for (; y1 < CHUNK_SIZE; y1++) {
+                    int full = 1;
+                    for (int k = z; k < z1 && full; k++) {
+                        for (int i = x; i < x1 && full; i++) {
+                            full = occluder_solid(padded, used, i, y1, k);
+                        }
+                    }
+                    if (!full) {
+                        break;
+                    }
+                }
+                for (int j = y; j < y1; j++) {
+                    for (int k = z; k < z1; k++) {
+                        memset(used + CHUNK_INDEX(x, j, k), 1, x1 - x);
+                    }
+                }
+                Occluder box = {
+                    {ox + x, oy + y, oz + z}, {ox + x1, oy + y1, oz + z1}};
+                int volume = occluder_volume(&box);
+                if (volume < MESH_MIN_OCCLUDER) {
+                    continue;
+                }
+                // insertion into the list, which stays sorted by volume
+                int n = mesh->occluder_count;
+                if (n == MESH_MAX_OCCLUDERS) {
+                    if (volume <= occluder_volume(mesh->occluders + n - 1)) {
+                        continue;
+                    }
+                    n--;
+                }
+                while (n > 0 &&
+                    occluder_volume(mesh->occluders + n - 1) < volume)
+                {
+                    mesh->occluders[n] = mesh->occluders[n - 1];
+                    n--;
+                }
+                mesh->occluders[n] = box;
+                mesh->occluder_count =
+                    MIN(mesh->occluder_count + 1, MESH_MAX_OCCLUDERS);
+            }
+        }
+    }
+    free(used);
+}
+
+void mesh_chunk(
+    Mesh *mesh, const unsigned char *padded, int ox, int oy, int oz,
+    int flags)
+{
+    int faces[6];
+    mesh->data = NULL;
+    mesh->size = 0;
+    mesh->flags = flags;
+    mesh->faces = 0;
+    mesh->skipped = 0;
+    int min[3] = {CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE};
+    int max[3] = {0, 0, 0};
+    for (int y = 1; y <= CHUNK_SIZE; y++) {
+        for (int z = 1; z <= CHUNK_SIZE; z++) {
+            for (int x = 1; x <= CHUNK_SIZE; x++) {
+                if (!padded[PADDED_INDEX(x, y, z)]) {
+                    continue;
+                }
+                int total = exposed_faces(padded, x, y, z, faces);
+                mesh->faces += total;
+                mesh->skipped += 6 - total;
+                if (total) {
+                    min[0] = MIN(min[0], x); max[0] = MAX(max[0], x);
+                    min[1] = MIN(min[1], y); max[1] = MAX(max[1], y);
+                    min[2] = MIN(min[2], z); max[2] = MAX(max[2], z);
+                }
+            }
+        }
+    }
+    // fully buried chunks have no faces but still hide what is behind them
+    mesh_occluders(mesh, padded, ox, oy, oz);
+    if (!mesh->faces) {
+        return;
+    }
+    int origin[3] = {ox, oy, oz};
+    for (int i = 0; i < 3; i++) {
+        mesh->min[i] = origin[i] + min[i] - 1;
+        mesh->max[i] = origin[i] + max[i] - 1;
+    }
+    Occlusion *o = (Occlusion *)malloc(sizeof(Occlusion));
+    occlusion_init(o, padded);
+    // the culled face count bounds the merged one, so data is big enough
+    int face_size = mesh_vertex_size(flags) * mesh_face_vertices(flags);
+    mesh->data = malloc(face_size * mesh->faces);
+    if (flags & MESH_GREEDY) {
+        mesh_greedy(mesh, o, ox, oy, oz);
+    }
+    else {
+        mesh_culled(mesh, o, ox, oy, oz);
+    }
+    mesh->size = face_size * mesh->faces;
+    free(o);
+}
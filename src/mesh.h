@@ -0,0 +1,63 @@
+#ifndef _mesh_h_
+#define _mesh_h_
+
+#include <GL/glew.h>
+#include "config.h"
+
+// blocks looked at above a cell when shading it
+#define SHADE_HEIGHT 8
+
+// chunk blocks plus a one block border copied from the neighbouring chunks,
+// with SHADE_HEIGHT extra layers on top for shading
+#define PADDED_SIZE (CHUNK_SIZE + 2)
+#define PADDED_HEIGHT (PADDED_SIZE + SHADE_HEIGHT)
+#define PADDED_VOLUME (PADDED_SIZE * PADDED_SIZE * PADDED_HEIGHT)
+#define PADDED_INDEX(x, y, z) \
+    (((y) * PADDED_SIZE + (z)) * PADDED_SIZE + (x))
+
+// mesh_chunk flags
+#define MESH_GREEDY 1
+#define MESH_PACKED 2
+#define MESH_INDEXED 4
+
+// most faces a chunk can produce, a checkerboard of single blocks
+#define MESH_MAX_FACES (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE * 3)
+
+// float vertices are position, normal, uv, ao and light; packed ones are
+// the 8 bytes written by make_face_packed
+#define FLOAT_VERTEX_SIZE (sizeof(GLfloat) * 10)
+#define PACKED_VERTEX_SIZE 8
+
+// solid boxes kept per chunk for occlusion culling, the largest first;
+// smaller ones hide too little to be worth drawing
+#define MESH_MAX_OCCLUDERS 8
+#define MESH_MIN_OCCLUDER 16
+
+typedef struct {
+    // world block bounds, max exclusive
+    int min[3];
+    int max[3];
+} Occluder;
+
+typedef struct {
+    void *data;
+    // bytes of vertex data, 6 vertices per face or 4 when indexed
+    int size;
+    int flags;
+    int faces;
+    int skipped;
+    // world block bounds of the blocks that produced faces
+    int min[3];
+    int max[3];
+    int occluder_count;
+    Occluder occluders[MESH_MAX_OCCLUDERS];
+} Mesh;
+
+void mesh_chunk(
+    Mesh *mesh, const unsigned char *padded, int ox, int oy, int oz,
+    int flags);
+
+int mesh_vertex_size(int flags);
+int mesh_face_vertices(int flags);
+
+#endif
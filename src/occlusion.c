@@ -0,0 +1,223 @@
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include "occlusion.h"
+#include "util.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// points closer than this to the eye plane cannot be projected safely
+#define OCCLUSION_NEAR 0.125
+
+typedef struct {
+    float x;
+    float y;
+    float z;
+} ScreenPoint;
+
+static int project(
+    OcclusionBuffer *buffer, float x, float y, float z, ScreenPoint *point)
+{
+    float *m = buffer->matrix;
+    float cx = m[0] * x + m[4] * y + m[8] * z + m[12];
+    float cy = m[1] * x + m[5] * y + m[9] * z + m[13];
+    float cz = m[2] * x + m[6] * y + m[10] * z + m[14];
+    float cw = m[3] * x + m[7] * y + m[11] * z + m[15];
+    if (cw < OCCLUSION_NEAR) {
+        return 0;
+    }
+    point->x = (cx / cw * 0.5 + 0.5) * buffer->width;
+    point->y = (cy / cw * 0.5 + 0.5) * buffer->height;
+    point->z = cz / cw;
+    return 1;
+}
+
+void occlusion_init(OcclusionBuffer *buffer, int width, int height) {
+    buffer->width = width;
+    buffer->height = height;
+    buffer->depth = (float *)malloc(sizeof(float) * width * height);
+    buffer->faces = 0;
+}
+
+void occlusion_free(OcclusionBuffer *buffer) {
+    free(buffer->depth);
+    buffer->depth = NULL;
+}
+
+void occlusion_clear(
+    OcclusionBuffer *buffer, float *matrix, float x, float y, float z)
+{
+    for (int i = 0; i < 16; i++) {
+        buffer->matrix[i] = matrix[i];
+    }
+    buffer->camera[0] = x;
+    buffer->camera[1] = y;
+    buffer->camera[2] = z;
+    int count = buffer->width * buffer->height;
+    for (int i = 0; i < count; i++) {
+        buffer->depth[i] = FLT_MAX;
+    }
+    buffer->faces = 0;
+}
+
+// Pixels lying entirely inside the projected face keep the nearer of their
+// depth and z; a pixel only partly covered is left alone, so
+// occlusion_test_box can treat every written pixel as fully hidden. The
+// face is drawn as one convex quad, since two conservative triangles would
+// leave the pixels on their shared diagonal unwritten. Four pixels are
+// handled at a time when SSE2 is available.
+static void draw_quad(OcclusionBuffer *buffer, ScreenPoint *p, float z) {
+    float area = 0;
+    for (int i = 0; i < 4; i++) {
+        ScreenPoint *s = p + i;
+        ScreenPoint *t = p + (i + 1) % 4;
+        area += s->x * t->y - t->x * s->y;
+    }
+    if (area == 0) {
+        return;
+    }
+    float sign = area > 0 ? 1 : -1;
+    // edge functions e = ex * px + ey * py + e0, positive inside, with e0
+    // moved inward by half a pixel so the test at a pixel's center holds
+    // only when all of its corners are inside
+    float ex[4], ey[4], e0[4];
+    for (int i = 0; i < 4; i++) {
+        ScreenPoint *s = p + i;
+        ScreenPoint *t = p + (i + 1) % 4;
+        ex[i] = -(t->y - s->y) * sign;
+        ey[i] = (t->x - s->x) * sign;
+        e0[i] = ((t->y - s->y) * s->x - (t->x - s->x) * s->y) * sign -
+            0.5f * (fabsf(ex[i]) + fabsf(ey[i]));
+    }
+    float minx = p[0].x, maxx = p[0].x, miny = p[0].y, maxy = p[0].y;
+    for (int i = 1; i < 4; i++) {
+        minx = MIN(minx, p[i].x); maxx = MAX(maxx, p[i].x);
+        miny = MIN(miny, p[i].y); maxy = MAX(maxy, p[i].y);
+    }
+    int x0 = ceilf(minx - 0.5);
+    int x1 = floorf(maxx - 0.5);
+    int y0 = ceilf(miny - 0.5);
+    int y1 = floorf(maxy - 0.5);
+    x0 = MAX(x0, 0); x1 = MIN(x1, buffer->width - 1);
+    y0 = MAX(y0, 0); y1 = MIN(y1, buffer->height - 1);
+    for (int y = y0; y <= y1; y++) {
+        float *row = buffer->depth + y * buffer->width;
+        float py = y + 0.5;
+        float e[4];
+        for (int i = 0; i < 4; i++) {
+            e[i] = ey[i] * py + e0[i];
+        }
+        int x = x0;
+#if defined(__SSE2__)
+        __m128 zz = _mm_set1_ps(z);
+        __m128 zero = _mm_setzero_ps();
+        for (; x + 3 <= x1; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f),
+                _mm_set_ps(3, 2, 1, 0));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int i = 0; i < 4; i++) {
+                __m128 v = _mm_add_ps(
+                    _mm_mul_ps(_mm_set1_ps(ex[i]), px), _mm_set1_ps(e[i]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(v, zero));
+            }
+            __m128 depth = _mm_loadu_ps(row + x);
+            __m128 nearer = _mm_min_ps(depth, zz);
+            _mm_storeu_ps(row + x, _mm_or_ps(
+                _mm_and_ps(inside, nearer), _mm_andnot_ps(inside, depth)));
+        }
+#endif
+        for (; x <= x1; x++) {
+            float px = x + 0.5;
+            if (ex[0] * px + e[0] >= 0 && ex[1] * px + e[1] >= 0 &&
+                ex[2] * px + e[2] >= 0 && ex[3] * px + e[3] >= 0)
+            {
+                row[x] = MIN(row[x], z);
+            }
+        }
+    }
+}
+
+void occlusion_add_box(OcclusionBuffer *buffer, float min[3], float max[3]) {
+    // only the faces turned toward the camera can hide anything
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+            float value = side ? max[axis] : min[axis];
+            if (side ? buffer->camera[axis] <= value :
+                buffer->camera[axis] >= value)
+            {
+                continue;
+            }
+            int u = (axis + 1) % 3;
+            int v = (axis + 2) % 3;
+            float corners[4][2] = {
+                {min[u], min[v]}, {max[u], min[v]},
+                {max[u], max[v]}, {min[u], max[v]}
+            };
+            ScreenPoint points[4];
+            int visible = 1;
+            float z = -FLT_MAX;
+            for (int i = 0; i < 4 && visible; i++) {
+                float world[3];
+                world[axis] = value;
+                world[u] = corners[i][0];
+                world[v] = corners[i][1];
+                visible = project(
+                    buffer, world[0], world[1], world[2], points + i);
+                z = MAX(z, points[i].z);
+            }
+            // a face crossing the eye plane is dropped rather than clipped
+            if (!visible) {
+                continue;
+            }
+            draw_quad(buffer, points, z);
+            buffer->faces++;
+        }
+    }
+}
+
+int occlusion_test_box(OcclusionBuffer *buffer, float min[3], float max[3]) {
+    float x0 = FLT_MAX, x1 = -FLT_MAX;
+    float y0 = FLT_MAX, y1 = -FLT_MAX;
+    float near = FLT_MAX;
+    for (int i = 0; i < 8; i++) {
+        ScreenPoint point;
+        if (!project(buffer,
+            i & 1 ? max[0] : min[0],
+            i & 2 ? max[1] : min[1],
+            i & 4 ? max[2] : min[2], &point))
+        {
+            return 1;
+        }
+        x0 = MIN(x0, point.x); x1 = MAX(x1, point.x);
+        y0 = MIN(y0, point.y); y1 = MAX(y1, point.y);
+        near = MIN(near, point.z);
+    }
+    int px0 = MAX(0, (int)floorf(x0));
+    int px1 = MIN(buffer->width - 1, (int)floorf(x1));
+    int py0 = MAX(0, (int)floorf(y0));
+    int py1 = MIN(buffer->height - 1, (int)floorf(y1));
+    if (px0 > px1 || py0 > py1) {
+        return 1;
+    }
+    // visible as soon as one pixel has nothing nearer than the box
+    for (int y = py0; y <= py1; y++) {
+        float *row = buffer->depth + y * buffer->width;
+        int x = px0;
+#if defined(__SSE2__)
+        __m128 nn = _mm_set1_ps(near);
+        for (; x + 3 <= px1; x += 4) {
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), nn))) {
+                return 1;
+            }
+        }
+#endif
+        for (; x <= px1; x++) {
+            if (row[x] >= near) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
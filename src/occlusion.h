@@ -0,0 +1,26 @@
+#ifndef _occlusion_h_
+#define _occlusion_h_
+
+// A small software depth buffer. The nearest solid boxes are drawn into
+// it each frame, then chunk bounds are tested against it so chunks hidden
+// behind terrain are skipped without touching the GPU. Depths are
+// normalized device z; every occluder face stores its farthest depth, so
+// a box is only reported hidden when something certainly covers it.
+typedef struct {
+    int width;
+    int height;
+    float *depth;
+    float matrix[16];
+    float camera[3];
+    // occluder faces drawn since the last clear
+    int faces;
+} OcclusionBuffer;
+
+void occlusion_init(OcclusionBuffer *buffer, int width, int height);
+void occlusion_free(OcclusionBuffer *buffer);
+void occlusion_clear(
+    OcclusionBuffer *buffer, float *matrix, float x, float y, float z);
+void occlusion_add_box(OcclusionBuffer *buffer, float min[3], float max[3]);
+int occlusion_test_box(OcclusionBuffer *buffer, float min[3], float max[3]);
+
+#endif
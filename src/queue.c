@@ -0,0 +1,67 @@
+#include "queue.h"
+
+void queue_init(Queue *queue) {
+    for (size_t i = 0; i < QUEUE_SIZE; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+        queue->cells[i].data = NULL;
+    }
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+int queue_push(Queue *queue, void *data) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    QueueCell *cell;
+    for (;;) {
+        cell = queue->cells + (pos & (QUEUE_SIZE - 1));
+        size_t sequence = atomic_load_explicit(
+            &cell->sequence, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                &queue->tail, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            return 0;
+        }
+        else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+    cell->data = data;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return 1;
+}
+
+void *queue_pop(Queue *queue) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    QueueCell *cell;
+    for (;;) {
+        cell = queue->cells + (pos & (QUEUE_SIZE - 1));
+        size_t sequence = atomic_load_explicit(
+            &cell->sequence, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                &queue->head, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            return NULL;
+        }
+        else {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+    void *data = cell->data;
+    atomic_store_explicit(
+        &cell->sequence, pos + QUEUE_SIZE, memory_order_release);
+    return data;
+}
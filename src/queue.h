@@ -0,0 +1,29 @@
+#ifndef _queue_h_
+#define _queue_h_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// must be a power of two
+#define QUEUE_SIZE 1024
+
+typedef struct {
+    atomic_size_t sequence;
+    void *data;
+} QueueCell;
+
+// Bounded multi-producer multi-consumer queue that never takes a lock.
+// Each cell carries a sequence number telling producers and consumers
+// whose turn it is, so a push or pop is a single compare and swap on
+// the shared position.
+typedef struct {
+    QueueCell cells[QUEUE_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+} Queue;
+
+void queue_init(Queue *queue);
+int queue_push(Queue *queue, void *data);
+void *queue_pop(Queue *queue);
+
+#endif
@@ -17,6 +17,57 @@ void update_fps(FPS *fps) {
   }
 }
 
+void frame_histogram_reset(FrameHistogram *histogram) {
+  memset(histogram, 0, sizeof(FrameHistogram));
+}
+
+void frame_histogram_add(FrameHistogram *histogram, double seconds) {
+  int index = seconds / FRAME_BUCKET_WIDTH;
+  index = MAX(index, 0);
+  index = MIN(index, FRAME_BUCKETS - 1);
+  histogram->buckets[index]++;
+  histogram->count++;
+  histogram->total += seconds;
+  histogram->worst = MAX(histogram->worst, seconds);
+}
+
+double frame_histogram_percentile(FrameHistogram *histogram, double percentile) {
+  // upper edge of the bucket holding the requested sample
+  unsigned int target = ceil(histogram->count * percentile / 100);
+  unsigned int total = 0;
+  for (int i = 0; i < FRAME_BUCKETS; i++) {
+    total += histogram->buckets[i];
+    if (total >= target && total) {
+      return MIN((i + 1) * FRAME_BUCKET_WIDTH, histogram->worst);
+    }
+  }
+  return histogram->worst;
+}
+
+void frame_histogram_print(FrameHistogram *histogram, const char *label) {
+  if (!histogram->count) {
+    return;
+  }
+  printf("%s: %u frames, mean %.2f ms, p50 %.2f ms, p99 %.2f ms, "
+    "max %.2f ms\n",
+    label, histogram->count, histogram->total / histogram->count * 1000,
+    frame_histogram_percentile(histogram, 50) * 1000,
+    frame_histogram_percentile(histogram, 99) * 1000,
+    histogram->worst * 1000);
+  for (int i = 0; i < FRAME_BUCKETS; i++) {
+    unsigned int value = histogram->buckets[i];
+    if (!value) {
+      continue;
+    }
+    int width = (int)ceil(60.0 * value / histogram->count);
+    printf("  %6.1f ms %7u ", (i + 1) * FRAME_BUCKET_WIDTH * 1000, value);
+    for (int j = 0; j < width; j++) {
+      putchar('#');
+    }
+    putchar('\n');
+  }
+}
+
 char *load_file(const char *path) {
   FILE *file = fopen(path, "rb");
   if (!file) {
@@ -41,6 +92,126 @@ GLuint gen_buffer(GLsizei size, GLfloat *data) {
   return buffer;
 }
 
+GLuint gen_quad_buffer(int quads) {
+  // two triangles per quad of 4 vertices, split along 0 - 2
+  GLuint *data = malloc(sizeof(GLuint) * 6 * quads);
+  for (int i = 0; i < quads; i++) {
+    GLuint *d = data + i * 6;
+    GLuint v = i * 4;
+    d[0] = v; d[1] = v + 1; d[2] = v + 2;
+    d[3] = v; d[4] = v + 2; d[5] = v + 3;
+  }
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * 6 * quads, data,
+    GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  free(data);
+  return buffer;
+}
+
+// Vertex array objects come from GL 3.0 or ARB_vertex_array_object, or
+// from the APPLE extension in legacy macOS contexts.
+int has_vertex_arrays(void) {
+  return GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object ||
+    GLEW_APPLE_vertex_array_object;
+}
+
+GLuint gen_vertex_array(void) {
+  GLuint array;
+  if (GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object) {
+    glGenVertexArrays(1, &array);
+  }
+  else {
+    glGenVertexArraysAPPLE(1, &array);
+  }
+  return array;
+}
+
+void bind_vertex_array(GLuint array) {
+  if (GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object) {
+    glBindVertexArray(array);
+  }
+  else {
+    glBindVertexArrayAPPLE(array);
+  }
+}
+
+void del_vertex_array(GLuint array) {
+  if (GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object) {
+    glDeleteVertexArrays(1, &array);
+  }
+  else {
+    glDeleteVertexArraysAPPLE(1, &array);
+  }
+}
+
+// Instanced draws need a divisor on the per-instance attributes, from
+// GL 3.3 or ARB_instanced_arrays, and the draw call itself, from GL 3.1
+// or ARB_draw_instanced.
+int has_instancing(void) {
+  return (GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays) &&
+    (GLEW_VERSION_3_1 || GLEW_ARB_draw_instanced);
+}
+
+void vertex_attrib_divisor(GLuint index, GLuint divisor) {
+  if (GLEW_VERSION_3_3) {
+    glVertexAttribDivisor(index, divisor);
+  }
+  else {
+    glVertexAttribDivisorARB(index, divisor);
+  }
+}
+
+void draw_arrays_instanced(GLenum mode, GLint first, GLsizei count,
+    GLsizei instances)
+{
+  if (GLEW_VERSION_3_1) {
+    glDrawArraysInstanced(mode, first, count, instances);
+  }
+  else {
+    glDrawArraysInstancedARB(mode, first, count, instances);
+  }
+}
+
+// Occlusion queries are core since GL 1.5. GL 3.3 and
+// ARB_occlusion_query2 add a yes or no target that can stop counting at
+// the first sample.
+int has_occlusion_queries(void) {
+  return GLEW_VERSION_1_5;
+}
+
+GLenum occlusion_query_target(void) {
+  if (GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2) {
+    return GL_ANY_SAMPLES_PASSED;
+  }
+  return GL_SAMPLES_PASSED;
+}
+
+// Conditional rendering comes from GL 3.0 or NV_conditional_render.
+int has_conditional_render(void) {
+  return GLEW_VERSION_3_0 || GLEW_NV_conditional_render;
+}
+
+void begin_conditional_render(GLuint query) {
+  if (GLEW_VERSION_3_0) {
+    glBeginConditionalRender(query, GL_QUERY_NO_WAIT);
+  }
+  else {
+    glBeginConditionalRenderNV(query, GL_QUERY_NO_WAIT_NV);
+  }
+}
+
+void end_conditional_render(void) {
+  if (GLEW_VERSION_3_0) {
+    glEndConditionalRender();
+  }
+  else {
+    glEndConditionalRenderNV();
+  }
+}
+
 void del_buffer(GLuint buffer) {
   glDeleteBuffers(1, &buffer);
 }
@@ -137,3 +308,123 @@ void load_png_texture(const char *file_name) {
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
   free(data);
 }
+
+// Texture arrays come from GL 3.0 or EXT_texture_array; building the mip
+// chain also needs glGenerateMipmap from framebuffer objects.
+int has_texture_arrays(void) {
+  return GLEW_VERSION_3_0 || (GLEW_EXT_texture_array &&
+    (GLEW_ARB_framebuffer_object || GLEW_EXT_framebuffer_object));
+}
+
+// Splits an atlas of columns x rows tiles into the layers of the bound
+// GL_TEXTURE_2D_ARRAY, tile (x, y) from the bottom left becoming layer
+// y * columns + x, and generates mipmaps. Each tile is filtered on its
+// own, so no neighbour bleeds in at any level. Magenta marks transparent
+// texels, which get zero alpha so the shader can test for them after
+// filtering.
+// Transparent texels take the average color of their opaque neighbours,
+// spreading outward pass by pass, so mipmaps blend edge colors instead
+// of the magenta key. A tile with no opaque texels is left black.
+static void bleed_tile(unsigned char *tile, int width, int height) {
+  int count = width * height;
+  unsigned char *filled = malloc(count);
+  unsigned char *next = malloc(count);
+  int remaining = 0;
+  for (int i = 0; i < count; i++) {
+    filled[i] = tile[i * 4 + 3] != 0;
+    remaining += !filled[i];
+    if (!filled[i]) {
+      tile[i * 4] = tile[i * 4 + 1] = tile[i * 4 + 2] = 0;
+    }
+  }
+  while (remaining) {
+    int changed = 0;
+    memcpy(next, filled, count);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        unsigned char *texel = tile + (y * width + x) * 4;
+        if (filled[y * width + x]) {
+          continue;
+        }
+        int sum[3] = {0, 0, 0};
+        int n = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+          for (int dx = -1; dx <= 1; dx++) {
+            int nx = x + dx;
+            int ny = y + dy;
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height ||
+                !filled[ny * width + nx])
+            {
+              continue;
+            }
+            unsigned char *other = tile + (ny * width + nx) * 4;
+            for (int c = 0; c < 3; c++) {
+              sum[c] += other[c];
+            }
+            n++;
+          }
+        }
+        if (n) {
+          for (int c = 0; c < 3; c++) {
+            texel[c] = sum[c] / n;
+          }
+          next[y * width + x] = 1;
+          remaining--;
+          changed = 1;
+        }
+      }
+    }
+    if (!changed) {
+      break;
+    }
+    memcpy(filled, next, count);
+  }
+  free(next);
+  free(filled);
+}
+
+int load_png_texture_array(const char *file_name, int columns, int rows) {
+  unsigned int error;
+  unsigned char *data;
+  unsigned int width, height;
+
+  error = lodepng_decode32_file(&data, &width, &height, file_name);
+  if (error) {
+    fprintf(stderr, "load_png_texture_array %s failed, error %u: %s\n", file_name, error, lodepng_error_text(error));
+    exit(1);
+  }
+
+  flip_image_vertical(data, width, height);
+  int tile_width = width / columns;
+  int tile_height = height / rows;
+  int tile_size = tile_width * tile_height * 4;
+  unsigned char *layers = malloc(tile_size * columns * rows);
+  unsigned char *layer = layers;
+  for (int y = 0; y < rows; y++) {
+    for (int x = 0; x < columns; x++) {
+      for (int row = 0; row < tile_height; row++) {
+        unsigned char *src = data +
+          ((y * tile_height + row) * width + x * tile_width) * 4;
+        memcpy(layer + row * tile_width * 4, src, tile_width * 4);
+      }
+      for (int i = 0; i < tile_size; i += 4) {
+        int magenta =
+          layer[i] == 255 && layer[i + 1] == 0 && layer[i + 2] == 255;
+        layer[i + 3] = magenta ? 0 : 255;
+      }
+      bleed_tile(layer, tile_width, tile_height);
+      layer += tile_size;
+    }
+  }
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, tile_width, tile_height,
+    columns * rows, 0, GL_RGBA, GL_UNSIGNED_BYTE, layers);
+  if (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object) {
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  }
+  else {
+    glGenerateMipmapEXT(GL_TEXTURE_2D_ARRAY);
+  }
+  free(layers);
+  free(data);
+  return columns * rows;
+}
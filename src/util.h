@@ -18,9 +18,39 @@ typedef struct {
   double since;
 } FPS;
 
+// frame times in half millisecond buckets, the last one catches the rest
+#define FRAME_BUCKETS 200
+#define FRAME_BUCKET_WIDTH 0.0005
+
+typedef struct {
+  unsigned int buckets[FRAME_BUCKETS];
+  unsigned int count;
+  double total;
+  double worst;
+} FrameHistogram;
+
 void update_fps(FPS *fps);
 
+void frame_histogram_reset(FrameHistogram *histogram);
+void frame_histogram_add(FrameHistogram *histogram, double seconds);
+double frame_histogram_percentile(FrameHistogram *histogram, double percentile);
+void frame_histogram_print(FrameHistogram *histogram, const char *label);
+
 GLuint gen_buffer(GLsizei size, GLfloat *data);
+GLuint gen_quad_buffer(int quads);
+int has_vertex_arrays(void);
+GLuint gen_vertex_array(void);
+void bind_vertex_array(GLuint array);
+void del_vertex_array(GLuint array);
+int has_instancing(void);
+void vertex_attrib_divisor(GLuint index, GLuint divisor);
+void draw_arrays_instanced(GLenum mode, GLint first, GLsizei count,
+    GLsizei instances);
+int has_occlusion_queries(void);
+GLenum occlusion_query_target(void);
+int has_conditional_render(void);
+void begin_conditional_render(GLuint query);
+void end_conditional_render(void);
 void del_buffer(GLuint buffer);
 
 GLfloat *malloc_faces(int components, int faces);
@@ -32,5 +62,7 @@ GLuint make_program(GLuint shader1, GLuint shader2);
 GLuint load_program(const char *path1, const char *path2);
 
 void load_png_texture(const char *file_name);
+int has_texture_arrays(void);
+int load_png_texture_array(const char *file_name, int columns, int rows);
 
 #endif
@@ -0,0 +1,95 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "config.h"
+#include "worker.h"
+
+int cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+static void run_job(MeshJob *job) {
+    mesh_chunk(
+        &job->mesh, job->padded,
+        job->p * CHUNK_SIZE, job->q * CHUNK_SIZE, job->r * CHUNK_SIZE,
+        job->flags);
+    free(job->padded);
+    job->padded = NULL;
+}
+
+static void *worker_run(void *arg) {
+    WorkerPool *pool = (WorkerPool *)arg;
+    while (atomic_load(&pool->running)) {
+        MeshJob *job = (MeshJob *)queue_pop(&pool->jobs);
+        if (!job) {
+            pthread_mutex_lock(&pool->mutex);
+            job = (MeshJob *)queue_pop(&pool->jobs);
+            if (!job && atomic_load(&pool->running)) {
+                pthread_cond_wait(&pool->cond, &pool->mutex);
+            }
+            pthread_mutex_unlock(&pool->mutex);
+            if (!job) {
+                continue;
+            }
+        }
+        run_job(job);
+        // the caller keeps at most QUEUE_SIZE jobs in flight, so this
+        // only spins if the main thread is far behind on polling
+        while (!queue_push(&pool->done, job)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+void worker_pool_init(WorkerPool *pool, int count) {
+    pool->count = count;
+    atomic_init(&pool->running, 1);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    queue_init(&pool->jobs);
+    queue_init(&pool->done);
+    pool->threads = (pthread_t *)calloc(count, sizeof(pthread_t));
+    for (int i = 0; i < count; i++) {
+        pthread_create(pool->threads + i, NULL, worker_run, pool);
+    }
+}
+
+void worker_pool_free(WorkerPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    atomic_store(&pool->running, 0);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->count = 0;
+    MeshJob *job;
+    while ((job = (MeshJob *)queue_pop(&pool->jobs))) {
+        free(job->padded);
+        free(job);
+    }
+    while ((job = (MeshJob *)queue_pop(&pool->done))) {
+        free(job->mesh.data);
+        free(job);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+}
+
+int worker_pool_submit(WorkerPool *pool, MeshJob *job) {
+    if (!queue_push(&pool->jobs, job)) {
+        return 0;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return 1;
+}
+
+MeshJob *worker_pool_poll(WorkerPool *pool) {
+    return (MeshJob *)queue_pop(&pool->done);
+}
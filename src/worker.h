@@ -0,0 +1,39 @@
+#ifndef _worker_h_
+#define _worker_h_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "mesh.h"
+#include "queue.h"
+
+typedef struct {
+    int p;
+    int q;
+    int r;
+    int id;
+    // MESH_* flags passed to mesh_chunk
+    int flags;
+    // upload order, lower goes first
+    int priority;
+    // snapshot of the chunk and its border, freed by the worker
+    unsigned char *padded;
+    Mesh mesh;
+} MeshJob;
+
+typedef struct {
+    pthread_t *threads;
+    int count;
+    atomic_int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    Queue jobs;
+    Queue done;
+} WorkerPool;
+
+int cpu_count(void);
+void worker_pool_init(WorkerPool *pool, int count);
+void worker_pool_free(WorkerPool *pool);
+int worker_pool_submit(WorkerPool *pool, MeshJob *job);
+MeshJob *worker_pool_poll(WorkerPool *pool);
+
+#endif
@@ -0,0 +1,65 @@
+#include <math.h>
+#include "config.h"
+#include "util.h"
+#include "world.h"
+
+#define TERRAIN_BASE -24
+#define TERRAIN_AMPLITUDE 10
+#define TERRAIN_DEPTH 4
+
+static float lattice(int x, int z) {
+    unsigned int h = (unsigned int)x * 374761393u + (unsigned int)z * 668265263u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    h = h ^ (h >> 16);
+    return (h & 0xffff) / 65535.0f;
+}
+
+static float value_noise(float x, float z) {
+    int x0 = floorf(x);
+    int z0 = floorf(z);
+    float tx = x - x0;
+    float tz = z - z0;
+    tx = tx * tx * (3 - 2 * tx);
+    tz = tz * tz * (3 - 2 * tz);
+    float a = lattice(x0, z0);
+    float b = lattice(x0 + 1, z0);
+    float c = lattice(x0, z0 + 1);
+    float d = lattice(x0 + 1, z0 + 1);
+    float top = a + (b - a) * tx;
+    float bottom = c + (d - c) * tx;
+    return top + (bottom - top) * tz;
+}
+
+int terrain_height(int x, int z) {
+    float f = 0;
+    float amplitude = 0.5;
+    float frequency = 1 / 64.0;
+    for (int i = 0; i < 4; i++) {
+        f += value_noise(x * frequency, z * frequency) * amplitude;
+        amplitude /= 2;
+        frequency *= 2;
+    }
+    return TERRAIN_BASE + (int)(f * TERRAIN_AMPLITUDE * 2);
+}
+
+void create_world(int p, int q, int r, world_func func, void *arg) {
+    int y0 = q * CHUNK_SIZE;
+    int y1 = y0 + CHUNK_SIZE - 1;
+    int top = TERRAIN_BASE + TERRAIN_AMPLITUDE * 2;
+    int bottom = TERRAIN_BASE - TERRAIN_DEPTH;
+    if (y0 > top || y1 < bottom) {
+        return;
+    }
+    for (int dx = 0; dx < CHUNK_SIZE; dx++) {
+        for (int dz = 0; dz < CHUNK_SIZE; dz++) {
+            int x = p * CHUNK_SIZE + dx;
+            int z = r * CHUNK_SIZE + dz;
+            int h = terrain_height(x, z);
+            int start = MAX(h - TERRAIN_DEPTH + 1, y0);
+            int end = MIN(h, y1);
+            for (int y = start; y <= end; y++) {
+                func(x, y, z, y == h ? 1 : 7, arg);
+            }
+        }
+    }
+}
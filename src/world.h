@@ -0,0 +1,9 @@
+#ifndef _world_h_
+#define _world_h_
+
+typedef void (*world_func)(int, int, int, int, void *);
+
+int terrain_height(int x, int z);
+void create_world(int p, int q, int r, world_func func, void *arg);
+
+#endif